@@ -0,0 +1,57 @@
+import numpy as np
+
+import sys
+
+# Reader for the columnar files written by MarketStateRecorder (src/market_recorder.h).
+# The file is memory mapped; raw columns are views into the map, varint columns are decoded with numpy.
+
+MAGIC = b'SDBCOL1\0'
+DELTA_VARINT, F64, F32 = 0, 1, 2
+
+
+def _varints( b : np.ndarray, n : int ) -> np.ndarray :
+    # LEB128: the last byte of a value has the high bit clear
+    ends = np.flatnonzero( b < 0x80 )
+    assert len(ends) == n, f'expected {n} varints, found {len(ends)}'
+    starts = np.concatenate( ([0], ends[:-1] + 1) )
+    pos = np.arange( len(b) ) - np.repeat( starts, ends - starts + 1 )
+    parts = (b & 0x7f).astype(np.uint64) << (7 * pos).astype(np.uint64)
+    z = np.add.reduceat( parts, starts ) if n > 0 else np.zeros( 0, dtype=np.uint64 )
+    d = (z >> np.uint64(1)).astype(np.int64) ^ -(z & np.uint64(1)).astype(np.int64) # zigzag
+    return np.cumsum( d )
+
+
+def read_market_states( fname : str ) -> dict :
+    m = np.memmap( fname, dtype=np.uint8, mode='r' )
+    assert bytes(m[:8]) == MAGIC, f'{fname} is not a market state file'
+    offset = 8
+    n_columns = int( m[offset:offset+4].view('<u4')[0] ); offset += 4
+    names, encodings = [], []
+    for _ in range(n_columns) :
+        encodings.append( int(m[offset]) )
+        length = int(m[offset+1])
+        names.append( bytes(m[offset+2:offset+2+length]).decode() )
+        offset += 2 + length
+    blocks = { name : [] for name in names }
+    while offset < len(m) :
+        n_rows = int( m[offset:offset+4].view('<u4')[0] ); offset += 4
+        lengths = m[offset:offset+4*n_columns].view('<u4').astype(np.int64); offset += 4*n_columns
+        for name, enc, length in zip(names, encodings, lengths) :
+            payload = m[offset:offset+length]
+            if enc == DELTA_VARINT :
+                blocks[name].append( _varints( np.asarray(payload), n_rows ) )
+            elif enc == F64 :
+                blocks[name].append( payload.view('<f8') )
+            elif enc == F32 :
+                blocks[name].append( payload.view('<f4') )
+            else :
+                raise ValueError(f'unknown encoding {enc} for column {name}')
+            offset += length
+    # a single block is returned as is, so raw columns stay views into the map
+    return { name : (b[0] if len(b) == 1 else np.concatenate(b)) for name, b in blocks.items() }
+
+
+if __name__ == '__main__' :
+    for fname in sys.argv[1:] :
+        d = read_market_states( fname )
+        print( fname, len(d['time']), 'rows', ' '.join(d.keys()) )
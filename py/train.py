@@ -8,6 +8,12 @@ import torchmetrics.functional
 import glob
 import os.path
 
+# the columns of a shard of TorchShardWriter (src/torch_export.h): the market, the wm labels, then n_features
+# features of a FeaturePipeline. a model sees the market and the features, what ModelAgent gives it, and learns the
+# first label.
+N_MARKET_COLUMNS = 25
+N_LABELS = 5
+
 
 class SequenceDataset(torch.utils.data.Dataset):
 
@@ -16,7 +22,9 @@ class SequenceDataset(torch.utils.data.Dataset):
     @staticmethod
     def get_files( path ) : return sorted(glob.glob( os.path.join( path, "torch*.pt" ) ))
 
-    def __init__(self, path='../data'):
+    def __init__(self, path='../data', n_features=0):
+        self.n_features = n_features
+        self.n_inputs = N_MARKET_COLUMNS + n_features
         files = self.get_files( path )[0:10]
         self.files = files[0:-1]
         self.test_file = files[-1]
@@ -30,9 +38,10 @@ class SequenceDataset(torch.utils.data.Dataset):
 
     def get_file(self, fname ) : 
         d = torch.load( fname , weights_only = True)
-        assert d.size(1)==30 
-        x = d[:self.n,0:25].clone() 
-        y = d[:self.n,  25].clone().unsqueeze(1) 
+        n_features = d.size(1) - N_MARKET_COLUMNS - N_LABELS
+        assert n_features == self.n_features, f"{fname}: {n_features} features, expected {self.n_features}"
+        x = torch.cat( [ d[:self.n, 0:N_MARKET_COLUMNS], d[:self.n, N_MARKET_COLUMNS + N_LABELS:] ], 1 )
+        y = d[:self.n, N_MARKET_COLUMNS].clone().unsqueeze(1) 
         return x, y
 
 
@@ -55,6 +64,23 @@ class LSTMSequenceModel(BaseSequenceModel):
         y = self.fc(output)
         return y  
 
+class LSTMStep(nn.Module):
+    # one step of an LSTMSequenceModel, the state in and out: what TorchModelBatch (src/torch_model.h) runs,
+    # as TorchModelBatch(fname, N_MARKET_COLUMNS + n_features, 2, 2, 16) for the model of main(). the model is
+    # trained on consecutive shard rows, one per market state, and ModelAgent steps it on every market state too.
+    def __init__(self, model):
+        super(LSTMStep, self).__init__()
+        self.rnn = model.rnn
+        self.fc = model.fc
+
+    def forward(self, x, h, c):
+        output, (h, c) = self.rnn(x, (h, c))
+        y = self.fc(output)
+        return y, h, c
+
+def export_step_model(model, fname):
+    torch.jit.script(LSTMStep(model)).save(fname)
+
 class RNNSequenceModel(BaseSequenceModel):
     def __init__(self, input_size=4, hidden_size=16):
         super(RNNSequenceModel, self).__init__()
@@ -156,22 +182,23 @@ def train_model(model, dataloader, criterion, optimizer, num_epochs=10):
         if avg_loss < 0.1 : break
     return model
 
-def main(model_type='LSTM', seq_length=10, batch_size=32, num_epochs=500, learning_rate=0.001):
+def main(model_type='LSTM', seq_length=10, batch_size=32, num_epochs=500, learning_rate=0.001, n_features=0):
     # Create dataset and dataloader
-    dataset = SequenceDataset()
+    dataset = SequenceDataset(n_features=n_features)
+    input_size = dataset.n_inputs
     dataloader = torch.utils.data.DataLoader(dataset, batch_size=batch_size, shuffle=True)
 
     # Choose the model based on the argument
     if model_type == 'LSTM':
-        model = LSTMSequenceModel(input_size=25, hidden_size=16)
+        model = LSTMSequenceModel(input_size=input_size, hidden_size=16)
     elif model_type == 'RNN':
-        model = RNNSequenceModel(input_size=25, hidden_size=16)
+        model = RNNSequenceModel(input_size=input_size, hidden_size=16)
     elif model_type == 'GRU':
-        model = GRUSequenceModel(input_size=25, hidden_size=16)
+        model = GRUSequenceModel(input_size=input_size, hidden_size=16)
     elif model_type == 'CNN':
-        model = CNNSequenceModel(input_size=25, hidden_size=16, kernel_size=3)
+        model = CNNSequenceModel(input_size=input_size, hidden_size=16, kernel_size=3)
     elif model_type == 'Transformer':
-        model = TransformerSequenceModel(input_size=25, hidden_size=16, num_layers=2, nhead=4)
+        model = TransformerSequenceModel(input_size=input_size, hidden_size=16, num_layers=2, nhead=4)
     else:
         raise ValueError("Invalid model_type. Choose from 'LSTM', 'RNN', 'GRU', 'CNN', or 'Transformer'.")
 
@@ -1,6 +1,12 @@
 #pragma once
 #include "ob.h"
 #include "random_walk.h"
+#include "labels.h"
+#include "counter_rng.h"
+#include "binary_log.h"
+#include "market_recorder.h"
+#include "phase_trace.h"
+#include "feature_pipeline.h"
 
 #include <boost/random/exponential_distribution.hpp> 
 #include <boost/random/poisson_distribution.hpp> 
@@ -14,10 +20,12 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
 
-#include <ATen/ATen.h>
+#include <memory>
 #include <sstream>
-#include <torch/serialize.h>
-#include <torch/torch.h>
+#include <type_traits>
+
+#include "torch_export.h"
+#include "torch_model.h"
 
 namespace SDB {
 
@@ -203,6 +211,29 @@ namespace SDB {
         //method to make time go faster:
         TimeType next_action_time() const { return next_action_time_ ; }  ; 
         //actions in the market:
+        //one order at price on side: the others are cancelled, and nothing is placed while one is there or on its way.
+        template <TransportConcept Transport>
+            void keep_one_order( Transport & transport, LocalOrderIDType & local_id_counter,
+                    const PriceType price, const Side side, const SizeType size, const SizeType show ) {
+                for (auto & o : unacked_orders_)
+                    if (o.price_==price and o.side_==side) return;
+                bool found = false;
+                for (auto & o : orders_) {
+                    if (o.price_==price and o.side_==side) found = true;
+                    else if (not o.waiting_to_be_cancelled_) {
+                        o.waiting_to_be_cancelled_ = true;
+                        transport.cancel(client_id_, o.order_id_ );
+                    }
+                }
+                if (found) return;
+                const LocalOrderIDType local_order_id = local_id_counter++;
+                auto [fst, snd] = unacked_orders_.emplace(
+                    local_order_id, price, size, show, side);
+                if (not snd)
+                    throw std::runtime_error(
+                        "Problem placing un-acked order in map: " + std::to_string(local_order_id));
+                transport.place_order(client_id_, *fst);
+            }
 
     };
 
@@ -235,6 +266,7 @@ namespace SDB {
         boost::random::poisson_distribution<SizeType, double> order_size_;
         private:
         boost::random::bernoulli_distribution<double> side_, aggressive_;
+        std::shared_ptr<AgentRandomStream> rng_ ; //when set, draws come from here instead of mt_
         public:
         const size_t n_orders_ ;
         TimeType placement_time_ ; 
@@ -277,6 +309,15 @@ namespace SDB {
             placement_time_ = next_action_time_; 
         }
 
+        //switch to the counter based stream of (run, client id). draws then no longer depend on
+        //how other agents share mt_, so the agent behaves the same whatever else is in the simulation.
+        //the first placement time is redrawn from the new stream.
+        void use_counter_rng( const uint64_t run ) {
+            rng_ = std::make_shared<AgentRandomStream>( run, client_id_ );
+            next_action_time_ = safe_round<TimeType>(1e9*draw(placement_));
+            placement_time_ = next_action_time_; 
+        }
+
         void check_order_of_cancellation_times() const {
             if (cancellation_times_.empty()) return;
             auto &index = cancellation_times_.get<0>();
@@ -309,9 +350,9 @@ namespace SDB {
                     orders_.size() + unacked_orders_.size() < n_orders_ 
                 ) {
                     const double & wm = std::isnan(market_.wm_) ? 0 : market_.wm_; 
-                    const auto dp = order_price_(mt_);
-                    const Side passive_side = side_(mt_) ? Side::Offer : Side::Bid;
-                    const bool aggressive = aggressive_(mt_);
+                    const auto dp = draw(order_price_);
+                    const Side passive_side = draw(side_) ? Side::Offer : Side::Bid;
+                    const bool aggressive = draw(aggressive_);
                     const Side side = aggressive ? get_other_side(passive_side) : passive_side;
                     const double continuous_price =  passive_side == Side::Offer ? wm + dp : wm - dp;
                     //new we round up if offer, round down if buying
@@ -320,7 +361,7 @@ namespace SDB {
                     );
                     const LocalOrderIDType local_order_id = local_id_counter_++;
                     //std::cerr << "will place order with local id " << local_order_id << std::endl;
-                    auto order_size = order_size_(mt_);
+                    auto order_size = draw(order_size_);
                     if (order_size < 0 ) {
                         //SPDLOG_ERROR("negative order size from poisson distribution, client id {}", client_id_);
                         order_size = std::numeric_limits<SizeType>::max();
@@ -348,7 +389,7 @@ namespace SDB {
                     transport.place_order(client_id_, *fst);
                 }
                 while (market_.time_ >= placement_time_)
-                    placement_time_ += safe_round<TimeType>(1e9*placement_(mt_));
+                    placement_time_ += safe_round<TimeType>(1e9*draw(placement_));
 
                 auto & index = cancellation_times_.get<0>() ; 
                 //if (not index.empty()) std::cerr << "time: " << market_.time_ << ", cancellation time:" << index.begin()->t_cancel_ << "\n";
@@ -368,7 +409,7 @@ namespace SDB {
                 case NotifyMessageType::Ack : 
                     { 
                         //setup cancellation time
-                        TimeType cancellation_time =  market_.time_ + safe_round<TimeType>(1e9*cancellation_( mt_ ) );
+                        TimeType cancellation_time =  market_.time_ + safe_round<TimeType>(1e9*draw(cancellation_) );
                         cancellation_times_.emplace( cancellation_time, order_data.order_id_ );
                         //std::cerr << "inserted cancellation time: " << cancellation_time << ' ' << cancellation_times_.size() << std::endl;
                         break;
@@ -384,31 +425,25 @@ namespace SDB {
                     break;
             }
         }
-    };
 
-    struct EMA {
-        const double T_;
-        double x_prev_, t_prev_, ema_;
-        explicit EMA(const double T) : T_(T),
-                              x_prev_(std::numeric_limits<double>::quiet_NaN()),
-                              t_prev_(std::numeric_limits<double>::quiet_NaN()),
-                              ema_(std::numeric_limits<double>::quiet_NaN()) {
+        private:
+        //the distributions keep the parameters, the stream (or mt_) provides the randomness
+        double draw( const boost::random::exponential_distribution<> & d ) {
+            return rng_ ? rng_->exponential( d.lambda() ) : d(mt_);
         }
-        void update( const double & t, const double & x ) {
-            if (std::isnan(ema_))
-                ema_ = x;
-            else {
-                const double w = std::exp(-(t - t_prev_) / T_);
-                ema_ = w * ema_ + (1 - w) * x_prev_;
-            }
-            x_prev_ = x;
-            t_prev_ = t;
+        bool draw( const boost::random::bernoulli_distribution<double> & d ) {
+            return rng_ ? rng_->bernoulli( d.p() ) : d(mt_);
+        }
+        SizeType draw( const boost::random::poisson_distribution<SizeType, double> & d ) {
+            return rng_ ? rng_->poisson<SizeType>( d.mean() ) : d(mt_);
         }
     };
 
     struct TrendFollowerAgent : public Agent<TrendFollowerAgent> {
         LocalOrderIDType local_id_counter_;
         EMA ema_ ;
+        const FeaturePipeline * features_ ; //when given, the EMA is features_->ema(ema_index_) and ema_ is not used
+        size_t ema_index_ ;
         const double spread_ ;
         bool disabled_ ;
         size_t bid_count_ , ask_count_ ;
@@ -419,20 +454,33 @@ namespace SDB {
             const double T, const double spread) :
                 Agent<TrendFollowerAgent>(client_id, market),
                 local_id_counter_(0),
-                ema_(T), spread_(spread),
+                ema_(T), features_(nullptr), ema_index_(0), spread_(spread),
+                disabled_(false),
+                 bid_count_(0), ask_count_(0) { }
+        //reads the EMA with horizon features.config_.ema_horizons_[ema] from features
+        TrendFollowerAgent(
+            const ClientIDType client_id,
+            const MarketState &market,
+            const FeaturePipeline & features, const size_t ema, const double spread) :
+                Agent<TrendFollowerAgent>(client_id, market),
+                local_id_counter_(0),
+                ema_(features.config_.ema_horizons_.at(ema)), features_(&features), ema_index_(features.ema(ema)),
+                spread_(spread),
                 disabled_(false),
                  bid_count_(0), ask_count_(0) { }
         template <TransportConcept Transport>
             void handle_market_state_changed(Transport & transport) {
                 if (std::isnan(market_.wm_)) return;
-                ema_.update( 1e-9*market_.time_, market_.wm_ );
+                if (features_ == nullptr) ema_.update( 1e-9*market_.time_, market_.wm_ );
+                const double ema = features_ == nullptr ? ema_.ema_ : (*features_)[ema_index_];
+                if (std::isnan(ema)) return;
                 PriceType price ;
                 Side side;
-                if ( market_.wm_ > ema_.ema_ + spread_) {
+                if ( market_.wm_ > ema + spread_) {
                     //trending up. buy at the best offer
                     price = market_.ask_prices_[0];
                     side = Side::Bid;
-                } else if ( market_.wm_ < ema_.ema_ - spread_) {
+                } else if ( market_.wm_ < ema - spread_) {
                     //trending down. sell at the best bid.
                     price = market_.bid_prices_[0];
                     side = Side::Offer;
@@ -442,25 +490,7 @@ namespace SDB {
                 if (side==Side::Bid) ++bid_count_ ;
                 else ++ask_count_ ;
                 if (disabled_) return;
-                //do we have an order in this side and price? If so, don't do anything.
-                for (auto & o : unacked_orders_)
-                    if (o.price_==price and o.side_==side) return;
-                bool found = false;
-                for (auto & o : orders_) {
-                    if (o.price_==price and o.side_==side) found = true;
-                    else {
-                        o.waiting_to_be_cancelled_ = true;
-                        transport.cancel(client_id_, o.order_id_ );
-                    }
-                }
-                if (found) return;
-                const LocalOrderIDType local_order_id = local_id_counter_++;
-                auto [fst, snd] = unacked_orders_.emplace(
-                    local_order_id, price, 10, 1, side);
-                if (not snd)
-                    throw std::runtime_error(
-                        "Problem placing un-acked order in map: " + std::to_string(local_order_id));
-                transport.place_order(client_id_, *fst);
+                keep_one_order( transport, local_id_counter_, price, side, 10, 1 );
         }
         static void handle_message( const OrderData & , const NotifyMessageType ,
                 const SizeType , const PriceType  ) {
@@ -533,6 +563,89 @@ namespace SDB {
     };
 
 
+    //trades on what the model of batch_ predicts for the move of wm, as the first label of the torch shards (what
+    //py/train.py learns): every period_, buys size_ at the best offer when the prediction is above threshold_ and
+    //sells at the best bid when it is below -threshold_. the inputs are the market columns of a shard row, then
+    //the first features of features_ when the model takes more, through feature_input(). the model steps on
+    //every market state, as it was trained on every shard row, and only the trading waits for the period.
+    //agents sharing a batch make one forward pass per market state through
+    //markets_state_changed( agents, batch, transport ); on its own, an agent makes a batch of one.
+    struct ModelAgent : public Agent<ModelAgent> {
+        LocalOrderIDType local_id_counter_;
+        TorchModelBatch & batch_ ;
+        const FeaturePipeline * features_ ;
+        const size_t slot_ ; //in batch_
+        const TimeType period_ ;
+        const double threshold_ ;
+        const SizeType size_ ;
+        std::vector<float> row_ ;
+        size_t bid_count_ , ask_count_ ;
+
+        ModelAgent(
+            const ClientIDType client_id,
+            const MarketState &market,
+            TorchModelBatch & batch,
+            const TimeType period, const double threshold, const SizeType size,
+            const FeaturePipeline * features = nullptr ) :
+                Agent<ModelAgent>(client_id, market),
+                local_id_counter_(0), batch_(batch), features_(features), slot_(batch.add_slot()),
+                period_(period), threshold_(threshold), size_(size), row_(batch.n_inputs_),
+                bid_count_(0), ask_count_(0) {
+                    if (period_ <= 0) throw std::runtime_error("period should be positive: " + std::to_string(period_));
+                    if (size_ <= 0) throw std::runtime_error("size should be positive: " + std::to_string(size_));
+                    const size_t n_features = batch.n_inputs_ < N_MARKET_COLUMNS ? 0 : batch.n_inputs_ - N_MARKET_COLUMNS ;
+                    if (batch.n_inputs_ < N_MARKET_COLUMNS or (n_features > 0 and (features_ == nullptr or features_->size() < n_features)))
+                        throw std::runtime_error( std::format("the model takes {} inputs: {} market columns and {} features",
+                                    batch.n_inputs_, N_MARKET_COLUMNS, features_ == nullptr ? 0 : features_->size()) );
+                    next_action_time_ = period_;
+                }
+
+        bool due() const { return market_.time_ >= next_action_time_ and not std::isnan(market_.wm_); }
+        //the inputs of the market state into the batch, once per state
+        bool request() {
+            if (batch_.has_output( slot_, market_.time_ )) return false;
+            const size_t j = market_row( market_, row_.data() );
+            for (size_t i = j; i < row_.size(); ++i) row_[i] = feature_input( (*features_)[i - j] );
+            batch_.request( slot_, row_.data() );
+            return true;
+        }
+
+        template <TransportConcept Transport>
+            void handle_market_state_changed(Transport & transport) {
+                if (request()) batch_.run( market_.time_ );
+                if (not due()) return;
+                while (next_action_time_ <= market_.time_) next_action_time_ += period_;
+                const double prediction = batch_.output( slot_ );
+                PriceType price ;
+                Side side;
+                if (prediction > threshold_) {
+                    price = market_.ask_prices_[0];
+                    side = Side::Bid;
+                } else if (prediction < -threshold_) {
+                    price = market_.bid_prices_[0];
+                    side = Side::Offer;
+                } else
+                    return; //NaN too
+                if (side==Side::Bid) ++bid_count_ ;
+                else ++ask_count_ ;
+                keep_one_order( transport, local_id_counter_, price, side, size_, size_ );
+        }
+        static void handle_message( const OrderData & , const NotifyMessageType ,
+                const SizeType , const PriceType  ) {
+        }
+    };
+
+    //the agents, all of batch and of the same market, ask first, so that batch makes one forward pass per market state
+    template <TransportConcept Transport>
+        void markets_state_changed( std::vector<ModelAgent> & agents, TorchModelBatch & batch, Transport & transport ) {
+            for (auto & a : agents)
+                if (&a.batch_ != &batch)
+                    throw std::runtime_error( std::format("Agent {} runs on another model batch", a.client_id_) );
+            for (auto & a : agents) a.request();
+            if (not agents.empty()) batch.run( agents.front().market_.time_ );
+            for (auto & a : agents) a.markets_state_changed( transport );
+        }
+
     template <INotifier Notifier>
         struct PassThroughTransport {
             MatchingEngine & eng_;
@@ -543,6 +656,7 @@ namespace SDB {
             std::unordered_map<ClientIDType, PriceMakerAroundWM *> price_makers ;
             std::unordered_map<ClientIDType, TrendFollowerAgent *> trend_followers ;
             std::unordered_map<ClientIDType, SingleInstrumentMarketMaker *> single_instrument_market_makers_ ;
+            std::unordered_map<ClientIDType, ModelAgent *> model_agents_ ;
             std::vector<std::tuple<TimeType,ClientIDType, OrderData>> orders_to_place;
             std::vector<std::tuple<TimeType,OrderIDType>> orders_to_cancel;
             std::unordered_map<ClientIDType, std::unordered_map<PriceType, int> > price_counts;
@@ -554,18 +668,27 @@ namespace SDB {
             bool add_agent( PriceMakerAroundWM & agent ) {
                 if (trend_followers.contains( agent.client_id_ )) return false;
                 if (single_instrument_market_makers_.contains( agent.client_id_ )) return false;
+                if (model_agents_.contains( agent.client_id_ )) return false;
                 return price_makers.emplace( agent.client_id_, &agent ).second;
             }
             bool add_agent( TrendFollowerAgent & agent ) {
                 if (price_makers.contains( agent.client_id_ )) return false;
                 if (single_instrument_market_makers_.contains( agent.client_id_ )) return false;
+                if (model_agents_.contains( agent.client_id_ )) return false;
                 return trend_followers.emplace( agent.client_id_, &agent ).second;
             }
             bool add_agent( SingleInstrumentMarketMaker & agent ) {
                 if (price_makers.contains( agent.client_id_ )) return false;
                 if (trend_followers.contains( agent.client_id_ )) return false;
+                if (model_agents_.contains( agent.client_id_ )) return false;
                 return single_instrument_market_makers_.emplace( agent.client_id_, &agent ).second;
             }
+            bool add_agent( ModelAgent & agent ) {
+                if (price_makers.contains( agent.client_id_ )) return false;
+                if (trend_followers.contains( agent.client_id_ )) return false;
+                if (single_instrument_market_makers_.contains( agent.client_id_ )) return false;
+                return model_agents_.emplace( agent.client_id_, &agent ).second;
+            }
 
             void place_order( const ClientIDType cid, const OrderData & od ) {
                 price_counts.emplace( cid, std::unordered_map<PriceType, int>() )
@@ -636,6 +759,10 @@ namespace SDB {
                         find_and_handle_order_message(
                             single_instrument_market_makers_, o.client_id_, mtype,
                             o.local_id_, o.order_id_, trade_size, trade_price
+                        ) ||
+                        find_and_handle_order_message(
+                            model_agents_, o.client_id_, mtype,
+                            o.local_id_, o.order_id_, trade_size, trade_price
                         ) ;
                 if (not done)
                     throw std::runtime_error(std::format("Cannot find client id: {}", o.client_id_) );
@@ -659,7 +786,9 @@ namespace SDB {
         return min_time;
     }
 
-    template <INotifier Notifier>
+    //outptr gets every market state: as a text line for an std::ostream, through push() and finish() for a
+    //market sink such as MarketStateRecorder (simulate<Notifier, MarketStateRecorder>(...)).
+    template <INotifier Notifier, typename MarketSink = std::ostream>
     auto simulate(
         boost::random::mt19937 & mt,
         MarketState & market,
@@ -669,7 +798,7 @@ namespace SDB {
         Notifier & notifier,
         const double delay_lambda,
         const TimeType t_max,
-        std::ostream * outptr
+        std::type_identity_t<MarketSink> * outptr
         ) {
         PassThroughTransport<Notifier> transport(eng, notifier, delay_lambda);
         for (auto & a : price_makers)
@@ -735,9 +864,15 @@ namespace SDB {
                           market.ask_sizes_[2], market.ask_prices_[2]
             );
             */
-            if (outptr != nullptr)
-                *outptr << market << '\n';
+            if (outptr != nullptr) {
+                if constexpr (std::is_base_of_v<std::ostream, MarketSink>)
+                    *outptr << market << '\n';
+                else
+                    outptr->push( market );
+            }
         }
+        if constexpr (not std::is_base_of_v<std::ostream, MarketSink>)
+            if (outptr != nullptr) outptr->finish();
         return transport.price_counts;
     }
     inline double find_center_shift_for_range_bound(const double s0, const double s1, const double sm ) { 
@@ -857,27 +992,46 @@ namespace SDB {
         }
     };
 
-    template <typename Ensemble>
-    inline void experiment(boost::random::mt19937 & mt, std::ostream * mkt_out_ptr, std::ostream * params_out_ptr, 
+    struct ExperimentStats {
+        size_t n_steps_ ; //market states produced
+        int64_t max_used_ ; //most orders alive in the engine at any time
+    };
+
+    //mkt_out_ptr receives every market state through push() and finish() at the end of the run, with the
+    //features next to it when it takes them (push(market, features), as TorchShardWriter does).
+    //tracer, when given, gets the time spent in every phase of the loop (see phase_trace.h).
+    //wm_ of the market state is the one of the feature pipeline.
+    //Notify hears the engine and every market state. BinaryLogNotify hands them to the one process wide logger
+    //thread, which throttles the run when its ring is full and logging is on: runs on a farm take NOOPNotify.
+    template <typename Ensemble, typename MarketSink = TorchShardWriter, typename Notify = BinaryLogNotify>
+    inline ExperimentStats experiment(boost::random::mt19937 & mt, std::type_identity_t<MarketSink> * mkt_out_ptr, std::ostream * params_out_ptr, 
             Ensemble & ensemble, 
-            const TimeType t_max = static_cast<TimeType>( 1e9*24*60*60 )
+            const TimeType t_max = static_cast<TimeType>( 1e9*24*60*60 ),
+            PhaseTracer * tracer = nullptr,
+            const FeatureConfig & feature_config = {}
     ) {
         MatchingEngine  eng;
         MarketState & market = ensemble.market_;
-        PassThroughTransport<LogNotify> transport(eng, LogNotify::instance(), 0.0);
+        Notify notify; //BinaryLogNotify: own ring, so that experiments can run on several threads. text is made by the logger thread.
+        FeaturePipeline features( feature_config );
+        TeeNotify<Notify, FeaturePipeline> tee{ notify, features };
+        PassThroughTransport<TeeNotify<Notify, FeaturePipeline>> transport(eng, tee, 0.0);
         for( auto & pm : ensemble.price_makers_) transport.add_agent(pm.pm_);
         for( auto & pm : ensemble.single_instrument_market_makers_) transport.add_agent(pm);
         const std::vector<TrendFollowerAgent> trend_followers;
-        std::vector<MarketState> market_data; 
 
         double last_param_update_time = std::numeric_limits<double>::quiet_NaN();
 
         bool first = true;
+        size_t n_steps = 0;
         while ( market.time_ <= t_max) {
+            ++n_steps;
             {
-                std::ostringstream out ;
-                out << market;
-                SPDLOG_INFO( "{}", out.str() );
+                PhaseSpan span( tracer, ExperimentPhase::Publish );
+                notify.log( market );
+            }
+            {
+                PhaseSpan span( tracer, ExperimentPhase::Stats );
                 if (first) {
                     for (size_t i = 0; i < ensemble.price_makers_.size(); ++i)
                         SPDLOG_INFO(
@@ -893,46 +1047,63 @@ namespace SDB {
                     first = false;
                 }
             }
-            for (auto &pm: ensemble.price_makers_)
-                pm.pm_.update_next_action_time();
-            const TimeType t_algo = std::ranges::min_element( 
-                    ensemble.price_makers_.begin(), 
-                    ensemble.price_makers_.end(),
-                    [](const PriceMakerWithRandomParams & a,  const PriceMakerWithRandomParams & b) 
-                    { return a.pm_.next_action_time() < b.pm_.next_action_time(); }
-                    )->pm_.next_action_time();
-            transport.update_next_send_time(mt); //refresh delay_
-            const TimeType t_transport = transport.next_send_time(); //earliest order placement time + delay
-            const TimeType t = std::min(t_algo, t_transport);
+            TimeType t;
+            {
+                PhaseSpan span( tracer, ExperimentPhase::WakeUp );
+                for (auto &pm: ensemble.price_makers_)
+                    pm.pm_.update_next_action_time();
+                const TimeType t_algo = std::ranges::min_element( 
+                        ensemble.price_makers_.begin(), 
+                        ensemble.price_makers_.end(),
+                        [](const PriceMakerWithRandomParams & a,  const PriceMakerWithRandomParams & b) 
+                        { return a.pm_.next_action_time() < b.pm_.next_action_time(); }
+                        )->pm_.next_action_time();
+                transport.update_next_send_time(mt); //refresh delay_
+                const TimeType t_transport = transport.next_send_time(); //earliest order placement time + delay
+                t = std::min(t_algo, t_transport);
+            }
             if (t==market.time_)
                 throw std::runtime_error(std::format("Market time is stuck: {}", t) );
             market.time_ = t;
             eng.time_ = market.time_;
-            for (auto & a : ensemble.price_makers_) a.pm_.markets_state_changed(transport);
-            for (auto & a : ensemble.single_instrument_market_makers_) a.markets_state_changed(transport);
-            transport.send(market.time_);
+            {
+                PhaseSpan span( tracer, ExperimentPhase::StateChanged );
+                for (auto & a : ensemble.price_makers_) a.pm_.markets_state_changed(transport);
+                for (auto & a : ensemble.single_instrument_market_makers_) a.markets_state_changed(transport);
+            }
+            {
+                PhaseSpan span( tracer, ExperimentPhase::Send );
+                transport.send(market.time_);
+            }
             if (transport.next_send_time() <= market.time_)
                 throw std::runtime_error(std::format("Transport next send time should have moved : {} - {}",
                     transport.next_send_time(), market.time_) );
-            eng.level25(
-                market.bid_prices_, market.bid_sizes_, market.bid_ages_,
-                market.ask_prices_, market.ask_sizes_, market.ask_ages_
-            );
-            if (market.bid_sizes_[0] != 0 and market.ask_sizes_[0] != 0)
-                market.wm_ = static_cast<double>(market.bid_prices_[0] * market.ask_sizes_[0] +
-                                                 market.ask_prices_[0] * market.bid_sizes_[0]) /
-                             static_cast<double>(market.bid_sizes_[0] + market.ask_sizes_[0]);
-            else 
-                market.wm_ = std::numeric_limits<double>::quiet_NaN();
-
-            if (mkt_out_ptr != nullptr)
-                market_data.emplace_back( market );
-            //if (mkt_out_ptr != nullptr) *mkt_out_ptr << market.time_*1e-9/60./60. << ' ' << market.wm_ << '\n'  ;
+            {
+                PhaseSpan span( tracer, ExperimentPhase::Publish );
+                eng.level25(
+                    market.bid_prices_, market.bid_sizes_, market.bid_ages_,
+                    market.ask_prices_, market.ask_sizes_, market.ask_ages_
+                );
+                features.log( eng );
+                market.wm_ = features.wm();
+
+                if (mkt_out_ptr != nullptr) {
+                    if constexpr (requires { mkt_out_ptr->push( market, features ); })
+                        mkt_out_ptr->push( market, features );
+                    else
+                        mkt_out_ptr->push( market );
+                }
+                //if (mkt_out_ptr != nullptr) *mkt_out_ptr << market.time_*1e-9/60./60. << ' ' << market.wm_ << '\n'  ;
+            }
             
             const double dt = std::isnan( last_param_update_time ) ? 1+EPS : 1e-9*market.time_ - last_param_update_time;
             if (dt >= 1) {
-                ensemble.update(dt);
+                {
+                    PhaseSpan span( tracer, ExperimentPhase::ParamUpdate );
+                    ensemble.update(dt);
+                }
                 last_param_update_time = 1e-9*market.time_; 
+                PhaseSpan span( tracer, ExperimentPhase::Stats );
                 if (params_out_ptr != nullptr) {
                     double 
                         sum_cancel  = 0 , sumsq_cancel = 0,
@@ -966,137 +1137,14 @@ namespace SDB {
                     *params_out_ptr<< '\n'  ;
                 }
             }
+            if (tracer != nullptr) tracer->step( market.time_, eng.mem_.used_ );
 
         }
 
-        if (mkt_out_ptr != nullptr) {
-            SPDLOG_INFO("Done : {}", market_data.size() );
-            size_t start = 0; 
-            while (start < market_data.size() and market_data[start].time_ < 1e9*60*60/2 )
-                ++start; 
-            size_t end = start; 
-            while (end < market_data.size() and market_data[end].time_ < 1e9*60*60*23.5 ) 
-                ++end; 
-            constexpr size_t nextra = 5;
-            const size_t C = nextra  + 1 + 6*market.bid_prices_.size() ;
-            torch::Tensor market_torch = torch::empty({int64_t(end-start),  int64_t(C)});
-            if( C != size_t(market_torch.size(1)) ) 
-                throw std::runtime_error("I don't know these matrices");
-
-            SPDLOG_INFO("Allocated : {}", market_data.size() );
-
-            if ( not market_torch.is_contiguous()  ) {  
-                SPDLOG_ERROR("contiguous : {}" , market_torch.is_contiguous() );
-                for (int64_t i = 0; i < int64_t(end-start); ++i) { 
-                    const MarketState & m = market_data[i+start];
-                    int j = 0;
-                    market_torch.index_put_( {i,j} , static_cast<float>(m.time_*1e-9) ) ;
-                    for ( const auto x : m.bid_prices_ ) 
-                        market_torch.index_put_( {i,++j} , static_cast<float>(x) ) ;
-                    for ( const auto x : m.ask_prices_ ) 
-                        market_torch.index_put_( {i,++j} , static_cast<float>(x) ) ;
-                    for ( const auto x : m.bid_sizes_ ) 
-                        market_torch.index_put_( {i,++j} , static_cast<float>(x) ) ;
-                    for ( const auto x : m.ask_sizes_ ) 
-                        market_torch.index_put_( {i,++j} , static_cast<float>(x) ) ;
-                    for ( const auto & x : m.bid_ages_ ) 
-                        market_torch.index_put_( {i,++j} , x ) ;
-                    for ( const auto & x : m.ask_ages_ ) 
-                        market_torch.index_put_( {i,++j} , x ) ;
-
-                }
-                SPDLOG_INFO("Stored : {}", market_data.size() );
-            } else { 
-                const auto & temp0 = market_torch.index( {0,0} ) ; 
-                const auto & temp1 = market_torch.index( {0,1} ) ; 
-                const auto & temp2 = market_torch.index( {1,0} ) ; 
-                float * f0 = temp0.data_ptr<float>();
-                float * f1 = temp1.data_ptr<float>();
-                float * f2 = temp2.data_ptr<float>();
-                size_t d01 = std::distance( f0, f1 );
-                size_t d02 = std::distance( f0, f2 );
-                if ( 1 == d01 and C == d02 ) { 
-                    SPDLOG_INFO( "distance: {}, {}", d01, d02 );
-                    for (size_t i = 0; i < end-start; ++i) { 
-                        const MarketState & m = market_data[i+start];
-                        size_t j = 0;
-                        f0[i*C+j] = static_cast<float>(m.time_*1e-9) ;
-                        for ( const auto x : m.bid_prices_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-                        for ( const auto x : m.ask_prices_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-                        for ( const auto x : m.bid_sizes_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-                        for ( const auto x : m.ask_sizes_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-                        for ( const auto & x : m.bid_ages_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-                        for ( const auto & x : m.ask_ages_ ) 
-                            f0[i*C + ++j] = static_cast<float>(x) ;
-
-                        if (std::isnan( m.wm_ )) { 
-
-                        } else {
-                            double wm_high_watermark = m.wm_ ;
-                            double wm_low_watermark = m.wm_ ;
-                            double sum_wmsq_dt = 0;
-                            double sum_wm_dt = 0;
-                            double sum_dt = 0;
-                            double wm_last = m.wm_ ; 
-                            double t_last = m.time_*1e-9; 
-                            for (size_t ii = start+i+1; ii < market_data.size(); ++ii) { 
-                                const MarketState & mi = market_data[ii];
-                                //SPDLOG_INFO( "dt {}, , wm {}, sum_wm_dt {}, sum_wmsq_dt {}, sum_dt {}", (mi.time_ - m.time_)*1e-9 , mi.wm_ , sum_wm_dt, sum_wmsq_dt, sum_dt );
-                                if (mi.time_ - m.time_ < static_cast<TimeType>( 1e9*1 ) ) {
-                                    if (not std::isnan(mi.wm_) ) { 
-                                        wm_high_watermark = std::max( mi.wm_, wm_high_watermark );
-                                        wm_low_watermark = std::min( mi.wm_, wm_low_watermark );
-                                        const double t_next = 1e-9*mi.time_;
-                                        const double dt =( t_next - t_last ); 
-                                        sum_wm_dt += wm_last * dt;
-                                        sum_wmsq_dt += wm_last * wm_last * dt;
-                                        sum_dt += dt;
-                                        wm_last = mi.wm_ ; 
-                                        t_last = t_next;
-                                        //SPDLOG_INFO("post dt {}", dt );
-                                    }
-                                    continue;
-                                } else
-                                    break;
-                            }
-
-                            const double mean = sum_wm_dt / sum_dt;  
-                            double var = sum_wmsq_dt / sum_dt - mean*mean ;
-                            if (var < -EPS) 
-                                throw std::runtime_error(
-                                        fmt::format("Negative var? sum mw : {}, sum sq mw : {}, sum dt : {}", 
-                                            sum_wm_dt, sum_wmsq_dt, sum_dt ) );
-                            if (var < EPS) var = EPS;
-                            const double stdev = std::sqrt( var );
-
-                            f0[i*C + ++j] = static_cast<float>(wm_last - m.wm_) ;
-                            f0[i*C + ++j] = static_cast<float>(wm_high_watermark - m.wm_) ;
-                            f0[i*C + ++j] = static_cast<float>(wm_low_watermark - m.wm_) ;
-                            f0[i*C + ++j] = static_cast<float>(mean - m.wm_) ;
-                            f0[i*C + ++j] = static_cast<float>(stdev) ;
-                            if (j+1 != C) 
-                                throw std::runtime_error( fmt::format(
-                                            "Not enough space: We allocated {} columns, but used {} columns.", 
-                                            C, j+1 ) );
-                        }
-                    }
-                    SPDLOG_INFO("Stored : {}", market_data.size() );
-
-                } else {
-                    SPDLOG_ERROR( "distance: {}, {}", d01, d02 );
-                }
-            }
-            const auto pickled = torch::pickle_save(market_torch);
-            SPDLOG_INFO("Pickled : {}", pickled.size() );
-            mkt_out_ptr->write( pickled.data(), pickled.size() );
-            SPDLOG_INFO("Written : {}", pickled.size() );
-        } 
-
+        if (mkt_out_ptr != nullptr)
+            mkt_out_ptr->finish();
+        if (tracer != nullptr) tracer->finish();
+        return { n_steps, eng.mem_.max_used_ };
     }
 
 }
@@ -0,0 +1,277 @@
+#pragma once
+#include "ob.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace SDB {
+
+    //compact, fixed size log records. the matching thread only copies raw fields into one of these,
+    //text is made later by whoever reads the records (BinaryLogger's thread or the decode_log tool).
+    enum class BinaryLogTag : std::uint8_t { Order, Market, Error };
+
+    struct BinaryLogRecord {
+        struct OrderEvent {
+            TimeType creation_time_ ;
+            ClientIDType client_id_ ;
+            PriceType price_ ;
+            SizeType remaining_size_ ;
+            SizeType trade_size_ ;
+            PriceType trade_price_ ;
+            OrderIDType order_id_ ;
+            NotifyMessageType mtype_ ;
+            Side side_ ;
+        };
+        struct ErrorEvent {
+            static constexpr size_t MAX_MESSAGE = 62 ;
+            OrderIDType order_id_ ;
+            uint8_t length_ ;
+            char message_[MAX_MESSAGE] ; //truncated
+        };
+
+        //data
+        BinaryLogTag tag_ ;
+        TimeType time_ ;
+        union {
+            OrderEvent order_ ;
+            MarketState market_ ;
+            ErrorEvent error_ ;
+        };
+    };
+    static_assert( std::is_trivially_copyable_v<BinaryLogRecord> );
+
+    inline std::string format_record( const BinaryLogRecord & r ) {
+        switch (r.tag_) {
+            case BinaryLogTag::Order : {
+                const auto & o = r.order_;
+                return fmt::format( "t: {:12.9f} {}, cid:{}, age:{:12.9f}, side:{}, price:{:03d}, rs:{:05d}, ts:{}, tp:{}, oid:0x{:xspn}",
+                        r.time_*1e-9, o.mtype_, o.client_id_,
+                        1e-9*(r.time_-o.creation_time_), o.side_,
+                        o.price_,
+                        o.remaining_size_, o.trade_size_, o.trade_price_,
+                        spdlog::to_hex( o.order_id_ ) );
+            }
+            case BinaryLogTag::Market : {
+                std::ostringstream ss;
+                ss << r.market_ ;
+                return ss.str();
+            }
+            case BinaryLogTag::Error :
+                return fmt::format( "0x{:xspn}: {}", spdlog::to_hex(r.error_.order_id_),
+                        std::string_view(r.error_.message_, r.error_.length_) );
+        }
+        throw std::runtime_error("Unknown binary log tag: " + std::to_string(static_cast<int>(r.tag_)));
+    }
+
+    //single producer single consumer ring of records. capacity is a power of two.
+    //head_ is written by the consumer only, tail_ by the producer only.
+    struct SPSCRing {
+        //data
+        std::vector<BinaryLogRecord> records_ ;
+        const size_t mask_ ;
+        alignas(64) std::atomic<size_t> head_ ; //next to read
+        alignas(64) std::atomic<size_t> tail_ ; //next to write
+
+        explicit SPSCRing( const size_t capacity ) : records_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+            mask_(records_.size()-1), head_(0), tail_(0) {}
+
+        bool push( const BinaryLogRecord & r ) {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - head_.load(std::memory_order_acquire) == records_.size()) return false;
+            records_[tail & mask_] = r;
+            tail_.store(tail+1, std::memory_order_release);
+            return true;
+        }
+        bool pop( BinaryLogRecord & r ) {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_.load(std::memory_order_acquire)) return false;
+            r = records_[head & mask_];
+            head_.store(head+1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    //drains the rings of its producers on a background thread and hands every record to sink_.
+    //records of one producer come out in order, records of different producers are interleaved as they are found.
+    struct BinaryLogger {
+        using Sink = std::function<void(const BinaryLogRecord &)>;
+        struct Channel {
+            SPSCRing ring_ ;
+            std::atomic<bool> closed_ ;
+            size_t stalls_ ; //times the producer found the ring full. producer side only.
+            explicit Channel( const size_t capacity ) : ring_(capacity), closed_(false), stalls_(0) {}
+        };
+
+        //data
+        Sink sink_ ;
+        const size_t capacity_ ;
+        std::mutex m_ ; //guards channels_, taken on registration and once per sweep, never per record
+        std::vector<std::shared_ptr<Channel>> channels_ ;
+        std::atomic<bool> stop_ ;
+        std::jthread worker_ ;
+
+        explicit BinaryLogger( Sink sink, const size_t capacity = 1 << 16 ) :
+            sink_(std::move(sink)), capacity_(capacity), stop_(false),
+            worker_( [this]() { work(); } ) {}
+        ~BinaryLogger() {
+            stop_ = true;
+            worker_.join();
+        }
+        BinaryLogger( const BinaryLogger & ) = delete;
+
+        std::shared_ptr<Channel> open() {
+            auto c = std::make_shared<Channel>(capacity_);
+            std::lock_guard<std::mutex> lock(m_);
+            channels_.push_back(c);
+            return c;
+        }
+
+        //formats on the logger thread with spdlog, the same lines LogNotify writes.
+        //records below the current spdlog level are dropped before they are formatted.
+        static Sink text_sink() {
+            return []( const BinaryLogRecord & r ) {
+                if (r.tag_ == BinaryLogTag::Error)
+                    SPDLOG_ERROR( "{}", format_record(r) );
+                else if (spdlog::should_log( spdlog::level::info ))
+                    SPDLOG_INFO( "{}", format_record(r) );
+            };
+        }
+
+        static BinaryLogger & instance() {
+            spdlog::default_logger_raw(); //the registry has to outlive the logger, so it is created first
+            static BinaryLogger logger( text_sink() );
+            return logger;
+        }
+
+        private:
+        void work() {
+            std::vector<std::shared_ptr<Channel>> channels;
+            BinaryLogRecord r;
+            while (true) {
+                const bool stopping = stop_.load();
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+                    channels = channels_;
+                }
+                size_t n = 0;
+                for (auto & c : channels) {
+                    const bool closed = c->closed_.load(); //read before draining, so nothing pushed before closing is lost
+                    while (c->ring_.pop(r)) {
+                        sink_(r);
+                        ++n;
+                    }
+                    if (closed) {
+                        std::lock_guard<std::mutex> lock(m_);
+                        std::erase( channels_, c );
+                    }
+                }
+                if (stopping) return; //everything pushed before the stop has been drained
+                if (n == 0) std::this_thread::sleep_for( std::chrono::microseconds(100) );
+            }
+        }
+    };
+
+    //binary file sink: a header followed by raw records. the file is read back with read_binary_log().
+    //records are written as they are in memory, so the reader has to be built for the same platform.
+    struct BinaryLogFile {
+        static constexpr char MAGIC[8] = {'S','D','B','L','O','G','1','\0'} ;
+        std::shared_ptr<std::ofstream> out_ ;
+        explicit BinaryLogFile( const std::string & fname ) :
+            out_( std::make_shared<std::ofstream>(fname, std::ios::out|std::ios::binary) ) {
+                if (not *out_) throw std::runtime_error("Cannot open " + fname);
+                const uint32_t size = sizeof(BinaryLogRecord);
+                out_->write( MAGIC, sizeof(MAGIC) );
+                out_->write( reinterpret_cast<const char*>(&size), sizeof(size) );
+            }
+        void operator()( const BinaryLogRecord & r ) const {
+            out_->write( reinterpret_cast<const char*>(&r), sizeof(r) );
+        }
+    };
+
+    //calls f for every record of a file written by BinaryLogFile
+    template <typename F>
+        void read_binary_log( std::istream & in, F && f ) {
+            char magic[sizeof(BinaryLogFile::MAGIC)];
+            uint32_t size = 0;
+            in.read( magic, sizeof(magic) );
+            in.read( reinterpret_cast<char*>(&size), sizeof(size) );
+            if (not in or std::memcmp(magic, BinaryLogFile::MAGIC, sizeof(magic)) != 0)
+                throw std::runtime_error("Not a binary log");
+            if (size != sizeof(BinaryLogRecord))
+                throw std::runtime_error( fmt::format("Record size is {}, expected {}", size, sizeof(BinaryLogRecord)) );
+            BinaryLogRecord r;
+            while (in.read( reinterpret_cast<char*>(&r), sizeof(r) ))
+                f(r);
+        }
+
+    //INotifier that hands raw records to a BinaryLogger. one instance per producing thread.
+    //when the ring is full the producer waits for the logger, so records are never dropped.
+    struct BinaryLogNotify {
+        std::shared_ptr<BinaryLogger::Channel> channel_ ;
+        MarketState market_ ;
+
+        explicit BinaryLogNotify( BinaryLogger & logger = BinaryLogger::instance() ) :
+            channel_( logger.open() ),
+            market_{0, std::numeric_limits<double>::quiet_NaN(), {0}, {0}, {0}, {0}, {0}, {0}} {}
+        ~BinaryLogNotify() { channel_->closed_ = true; }
+        BinaryLogNotify( const BinaryLogNotify & ) = delete;
+
+        void log( const NotifyMessageType mtype , const Order & o, const TimeType t, const SizeType trade_size,
+                const PriceType trade_price) {
+            BinaryLogRecord r;
+            r.tag_ = BinaryLogTag::Order;
+            r.time_ = t;
+            r.order_ = { o.creation_time_, o.client_id_, o.price_, o.remaining_size_, trade_size, trade_price,
+                o.order_id_, mtype, o.side_ };
+            push(r);
+        }
+        void log( const MatchingEngine & eng ) {
+            market_.time_ = eng.time_ ;
+            eng.level25(
+                market_.bid_prices_, market_.bid_sizes_, market_.bid_ages_,
+                market_.ask_prices_, market_.ask_sizes_, market_.ask_ages_
+            );
+            log( market_ );
+        }
+        void log( const MarketState & market ) {
+            BinaryLogRecord r;
+            r.tag_ = BinaryLogTag::Market;
+            r.time_ = market.time_;
+            r.market_ = market;
+            push(r);
+        }
+        void error( const OrderIDType & oid , const std::string & msg) {
+            BinaryLogRecord r;
+            r.tag_ = BinaryLogTag::Error;
+            r.time_ = market_.time_;
+            r.error_.order_id_ = oid;
+            r.error_.length_ = static_cast<uint8_t>( std::min(msg.size(), BinaryLogRecord::ErrorEvent::MAX_MESSAGE) );
+            std::memcpy( r.error_.message_, msg.data(), r.error_.length_ );
+            push(r);
+        }
+
+        private:
+        void push( const BinaryLogRecord & r ) {
+            while (not channel_->ring_.push(r)) {
+                ++channel_->stalls_;
+                std::this_thread::yield();
+            }
+        }
+    };
+
+}
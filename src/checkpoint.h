@@ -0,0 +1,228 @@
+#pragma once
+#include "sim.h"
+
+#include <algorithm>
+#include <exception>
+#include <numeric>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+//book checkpoints of a ReplayProgram, to evaluate a shadow strategy over one day in segments running at the same
+//time. make_checkpoints() replays the market messages once and copies the resting orders every period of
+//simulated time. simulate_a_segments() replays every segment on an engine of its own, starting from the book of
+//its checkpoint, and returns a handler per segment:
+//
+//  const auto checkpoints = make_checkpoints( program, 5*60*1'000'000'000LL );
+//  auto segments = simulate_a_segments<StatisticsSimulationHandler<>>( program, checkpoints, prices, Side::Bid, ids, 0 );
+//  for (size_t k = 1; k < segments.size(); ++k) segments.front().append( segments[k] );
+//
+//the same checkpoints are the keyframes of BookHistory, which rebuilds the book at any time from the keyframe
+//before it and the tail of the program after the keyframe: the cost of a query is bounded by the period.
+
+namespace SDB {
+
+    struct BookCheckpoint {
+        struct Entry {
+            OrderIDType order_id_ ;
+            TimeType creation_time_ ;
+            ClientIDType client_id_ ;
+            LocalOrderIDType local_id_ ;
+            PriceType price_ ;
+            SizeType total_size_, show_, remaining_size_, shown_size_ ;
+            Side side_ ;
+            bool is_hidden_ ;
+        };
+
+        //data
+        size_t group_ ; //the book before this group of the program
+        TimeType time_ ; //of the group
+        OrderIDType next_order_id_ ;
+        std::vector<Entry> orders_ ; //bids then offers, best level first, in queue order. no shadow orders.
+
+        static BookCheckpoint take( const MatchingEngine & eng, const size_t group, const TimeType time ) {
+            BookCheckpoint c{ group, time, eng.next_order_id_, {} };
+            c.orders_.reserve( eng.ptr_set_.size() );
+            auto copy = [&c]( const auto & levels ) {
+                for (const auto & level : levels)
+                    for (const Order & o : level.orders_)
+                        if (not o.is_shadow_)
+                            c.orders_.push_back( { o.order_id_, o.creation_time_, o.client_id_, o.local_id_, o.price_,
+                                    o.total_size_, o.show_, o.remaining_size_, o.shown_size_, o.side_, o.is_hidden_ } );
+            };
+            copy( eng.all_bids_ );
+            copy( eng.all_offers_ );
+            return c;
+        }
+
+        //eng has to be empty
+        void restore( MatchingEngine & eng ) const {
+            if (not eng.ptr_set_.empty()) throw std::runtime_error("a checkpoint can only be restored into an empty engine");
+            eng.set_time( time_ );
+            eng.next_order_id_ = next_order_id_;
+            for (const Entry & e : orders_) {
+                Order & o = get_new_order( eng.mem_, e.order_id_, e.creation_time_, e.client_id_, e.local_id_, e.price_,
+                        e.total_size_, e.show_, e.side_, false, NOOPNotify::instance() );
+                o.remaining_size_ = e.remaining_size_;
+                o.shown_size_ = e.shown_size_;
+                o.is_hidden_ = e.is_hidden_;
+                eng.rest_order( o );
+            }
+        }
+    };
+
+    //a checkpoint at the first group of program and then at the first group of every period after it
+    inline std::vector<BookCheckpoint> make_checkpoints( const ReplayProgram & program, const TimeType period ) {
+        if (period <= 0) throw std::runtime_error("checkpoint period has to be positive: " + std::to_string(period));
+        std::vector<BookCheckpoint> checkpoints;
+        if (program.groups_.empty()) return checkpoints;
+        auto eng = std::make_unique<MatchingEngine>();
+        TimeType next = program.groups_.front().time_;
+        for (size_t g = 0; g < program.groups_.size(); ++g) {
+            const TimeType t = program.groups_[g].time_;
+            if (t >= next) {
+                checkpoints.push_back( BookCheckpoint::take( *eng, g, t ) );
+                while (next <= t) next += period;
+            }
+            program.replay_group( g, *eng, NOOPNotify::instance() );
+        }
+        return checkpoints;
+    }
+
+    //simulate_a over the whole program, cut at the checkpoints into segments that run at the same time. a segment
+    //starts without a shadow order: one resting across a boundary is placed again at the start of the next
+    //segment, at the back of its level. the handler of segment k is the k-th of the result.
+    template <ISimulationNotifier SN>
+        std::vector<SN> simulate_a_segments(
+                const ReplayProgram & program,
+                const std::vector<BookCheckpoint> & checkpoints,
+                const std::vector<double> & algo_prices,
+                const Side side,
+                const std::unordered_set<OrderIDType, boost::hash<OrderIDType>> & ids_not_to_be_used_by_simulator,
+                const ClientIDType cid_shadow,
+                unsigned n_threads = 0 ) {
+            if (checkpoints.empty() or checkpoints.front().group_ != 0)
+                throw std::runtime_error("the first checkpoint has to be at the start of the program");
+            for (size_t k = 1; k < checkpoints.size(); ++k)
+                if (checkpoints[k].group_ <= checkpoints[k-1].group_ or checkpoints[k].group_ >= program.groups_.size())
+                    throw std::runtime_error("bad checkpoint " + std::to_string(k) + " at group " + std::to_string(checkpoints[k].group_));
+
+            const size_t n = checkpoints.size();
+            std::vector<SN> handlers( n );
+            auto run = [&]( const size_t k ) {
+                const size_t last = k + 1 < n ? checkpoints[k+1].group_ : program.groups_.size();
+                auto eng = std::make_unique<MatchingEngine>();
+                checkpoints[k].restore( *eng );
+                simulate_a( program, checkpoints[k].group_, last, algo_prices, side, ids_not_to_be_used_by_simulator,
+                        cid_shadow, *eng, handlers[k] );
+            };
+
+            if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+            n_threads = static_cast<unsigned>( std::min<size_t>(n_threads, n) );
+            if (n_threads == 1) {
+                for (size_t k = 0; k < n; ++k) run(k);
+                return handlers;
+            }
+            std::vector<std::exception_ptr> errors(n_threads);
+            {
+                std::vector<std::jthread> threads;
+                threads.reserve(n_threads);
+                for (unsigned t = 0; t < n_threads; ++t)
+                    threads.emplace_back( [&, t]() {
+                            try { for (size_t k = t; k < n; k += n_threads) run(k); }
+                            catch (...) { errors[t] = std::current_exception(); }
+                            } );
+            }
+            for (auto & e : errors)
+                if (e) std::rethrow_exception(e);
+            return handlers;
+        }
+
+    //the book at any time of a program, from keyframes every period. the program has to outlive the history.
+    struct BookHistory {
+        //data
+        const ReplayProgram & program_ ;
+        const std::vector<BookCheckpoint> keyframes_ ;
+
+        BookHistory( const ReplayProgram & program, const TimeType period ) :
+            program_(program), keyframes_(make_checkpoints(program, period)) {}
+
+        //number of groups of the program up to and including time t
+        size_t end_group( const TimeType t ) const {
+            return std::upper_bound( program_.groups_.begin(), program_.groups_.end(), t,
+                    []( const TimeType time, const ReplayProgram::Group & g ) { return time < g.time_; } ) - program_.groups_.begin();
+        }
+        //the last keyframe at or before group end
+        const BookCheckpoint & keyframe( const size_t end ) const {
+            if (keyframes_.empty()) throw std::runtime_error("empty book history");
+            auto it = std::upper_bound( keyframes_.begin(), keyframes_.end(), end,
+                    []( const size_t g, const BookCheckpoint & c ) { return g < c.group_; } );
+            return it == keyframes_.begin() ? keyframes_.front() : *(it - 1);
+        }
+
+        //the book after every message up to and including time t, into eng, which is emptied first
+        void book_at( const TimeType t, MatchingEngine & eng ) const {
+            const size_t end = end_group(t);
+            const BookCheckpoint & k = keyframe(end);
+            eng.cancel_all( NOOPNotify::instance() );
+            k.restore( eng );
+            for (size_t g = k.group_; g < end; ++g) program_.replay_group( g, eng, NOOPNotify::instance() );
+            eng.set_time( std::max(t, eng.time_) );
+        }
+
+        //f(i, book) with the book at times[i], for every i. the queries are sorted and cut in runs, one per thread,
+        //and a run goes forward from one query to the next when no keyframe is closer. f is called from several
+        //threads at the same time, with different i.
+        template <typename F>
+            void books_at( const std::vector<TimeType> & times, F && f, unsigned n_threads = 0 ) const {
+                std::vector<size_t> order( times.size() );
+                std::iota( order.begin(), order.end(), 0 );
+                std::sort( order.begin(), order.end(), [&times]( const size_t a, const size_t b ) { return times[a] < times[b]; } );
+
+                auto run = [&]( const size_t begin, const size_t end ) {
+                    auto eng = std::make_unique<MatchingEngine>();
+                    size_t at = 0; //groups replayed into eng
+                    bool fresh = true;
+                    for (size_t q = begin; q < end; ++q) {
+                        const TimeType t = times[order[q]];
+                        const size_t end_g = end_group(t);
+                        const BookCheckpoint & k = keyframe(end_g);
+                        if (fresh or k.group_ > at) {
+                            eng->cancel_all( NOOPNotify::instance() );
+                            k.restore( *eng );
+                            at = k.group_;
+                            fresh = false;
+                        }
+                        for (; at < end_g; ++at) program_.replay_group( at, *eng, NOOPNotify::instance() );
+                        eng->set_time( std::max(t, eng->time_) );
+                        f( order[q], static_cast<const MatchingEngine &>(*eng) );
+                    }
+                };
+
+                if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+                n_threads = static_cast<unsigned>( std::max<size_t>(1, std::min<size_t>(n_threads, order.size())) );
+                const size_t chunk = (order.size() + n_threads - 1) / n_threads ;
+                if (n_threads == 1) {
+                    run( 0, order.size() );
+                    return;
+                }
+                std::vector<std::exception_ptr> errors(n_threads);
+                {
+                    std::vector<std::jthread> threads;
+                    threads.reserve(n_threads);
+                    for (unsigned c = 0; c < n_threads; ++c) {
+                        const size_t begin = c*chunk;
+                        const size_t end = std::min(order.size(), begin + chunk);
+                        if (begin < end) threads.emplace_back( [&, c, begin, end]() {
+                                try { run(begin, end); }
+                                catch (...) { errors[c] = std::current_exception(); }
+                                } );
+                    }
+                }
+                for (auto & e : errors)
+                    if (e) std::rethrow_exception(e);
+            }
+    };
+
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <boost/random/poisson_distribution.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+
+namespace SDB {
+
+    //Philox4x32-10 counter based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+    //the output is a pure function of (key, counter), so any draw of any stream can be computed
+    //independently of every other draw: no state to share between threads, nothing depends on scheduling.
+    struct Philox4x32 {
+        using Counter = std::array<uint32_t, 4> ;
+        using Key = std::array<uint32_t, 2> ;
+        static constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57 ;
+        static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85 ;
+
+        static Counter block( Counter c, Key k ) {
+            for (int round = 0; round < 10; ++round) {
+                const uint64_t p0 = static_cast<uint64_t>(M0) * c[0];
+                const uint64_t p1 = static_cast<uint64_t>(M1) * c[2];
+                c = { static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k[0], static_cast<uint32_t>(p1),
+                      static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k[1], static_cast<uint32_t>(p0) };
+                k[0] += W0;
+                k[1] += W1;
+            }
+            return c;
+        }
+    };
+
+    //the stream of a (run, agent, sub stream) triple. block b of it is Philox(key = run, counter = (b, agent, sub stream)).
+    struct CounterStream {
+        Philox4x32::Key key_ ;
+        uint32_t agent_, sub_ ;
+        CounterStream( const uint64_t run, const uint32_t agent, const uint32_t sub ) :
+            key_{ static_cast<uint32_t>(run), static_cast<uint32_t>(run >> 32) }, agent_(agent), sub_(sub) {}
+        Philox4x32::Counter block( const uint64_t b ) const {
+            return Philox4x32::block( { static_cast<uint32_t>(b), static_cast<uint32_t>(b >> 32), agent_, sub_ }, key_ );
+        }
+    };
+
+    //32 bit uniform random bit generator over a CounterStream, usable with boost::random distributions.
+    //draw i of the stream is word i%4 of block i/4 and can be reached directly with seek(i).
+    struct PhiloxEngine {
+        using result_type = uint32_t ;
+        CounterStream stream_ ;
+        uint64_t index_ ; //next draw
+        Philox4x32::Counter block_ ;
+
+        PhiloxEngine( const uint64_t run, const uint32_t agent, const uint32_t sub = 0 ) :
+            stream_(run, agent, sub), index_(0), block_(stream_.block(0)) {}
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+        result_type operator()() {
+            const uint64_t i = index_++;
+            if ((i & 3) == 0 and i != 0) block_ = stream_.block(i >> 2);
+            return block_[i & 3];
+        }
+        void seek( const uint64_t index ) {
+            index_ = index;
+            block_ = stream_.block(index >> 2);
+        }
+        void discard( const uint64_t n ) { seek(index_ + n); }
+    };
+
+    //per agent random variates, prefilled in batches and handed out by popping a buffer.
+    //unit exponentials, standard normals and uniforms are stored standardized, so changing a distribution's
+    //parameters never throws buffered variates away. poisson variates depend on the mean and are refilled when it changes.
+    //every kind has its own sub stream, so how many variates of one kind are used has no effect on the others.
+    struct AgentRandomStream {
+        static constexpr size_t BATCH = 64 ;
+        enum Sub : uint32_t { Uniform = 1, Exponential, Normal, Poisson };
+
+        template <typename T>
+            struct Buffer {
+                std::array<T, BATCH> values_ ;
+                size_t next_ = BATCH ;
+                uint64_t blocks_ = 0 ; //blocks of the sub stream used so far
+                bool empty() const { return next_ == BATCH ; }
+            };
+
+        //data
+        const uint64_t run_ ;
+        const uint32_t agent_ ;
+        CounterStream uniform_stream_, exponential_stream_, normal_stream_ ;
+        PhiloxEngine poisson_engine_ ;
+        Buffer<double> uniforms_, exponentials_, normals_ ;
+        Buffer<int> poissons_ ;
+        double poisson_mean_ ;
+
+        AgentRandomStream( const uint64_t run, const uint32_t agent ) :
+            run_(run), agent_(agent),
+            uniform_stream_(run, agent, Uniform),
+            exponential_stream_(run, agent, Exponential),
+            normal_stream_(run, agent, Normal),
+            poisson_engine_(run, agent, Poisson),
+            poisson_mean_(std::numeric_limits<double>::quiet_NaN()) {}
+
+        //u in (0, 1]
+        static double to_unit( const uint32_t hi, const uint32_t lo ) {
+            const uint64_t x = (static_cast<uint64_t>(hi) << 32) | lo ;
+            return static_cast<double>((x >> 11) + 1) * 0x1.0p-53 ;
+        }
+
+        double uniform() {
+            if (uniforms_.empty()) fill_uniforms();
+            return uniforms_.values_[uniforms_.next_++];
+        }
+        bool bernoulli( const double p ) { return uniform() <= p; }
+        double exponential( const double lambda ) {
+            if (exponentials_.empty()) fill_exponentials();
+            return exponentials_.values_[exponentials_.next_++] / lambda;
+        }
+        double normal( const double mean, const double sigma ) {
+            if (normals_.empty()) fill_normals();
+            return mean + sigma * normals_.values_[normals_.next_++];
+        }
+        template <typename IntType>
+            IntType poisson( const double mean ) {
+                if (mean != poisson_mean_) {
+                    //stale, drop the rest. the first draw at a new mean is not batched, so a mean that
+                    //changes on every call (random walk parameters) does not pay for a whole batch each time.
+                    poisson_mean_ = mean;
+                    poissons_.next_ = BATCH;
+                    check_poisson_mean();
+                    return clip<IntType>( boost::random::poisson_distribution<int, double>(mean)(poisson_engine_) );
+                }
+                if (poissons_.empty()) fill_poissons();
+                return clip<IntType>( poissons_.values_[poissons_.next_++] );
+            }
+
+        private:
+        //the fill loops below work on independent counters, so the compiler is free to vectorize the Philox rounds.
+        void fill_uniforms() {
+            for (size_t b = 0; b < BATCH/2; ++b) {
+                const auto r = uniform_stream_.block( uniforms_.blocks_ + b );
+                uniforms_.values_[2*b]   = to_unit(r[0], r[1]);
+                uniforms_.values_[2*b+1] = to_unit(r[2], r[3]);
+            }
+            uniforms_.blocks_ += BATCH/2;
+            uniforms_.next_ = 0;
+        }
+        void fill_exponentials() {
+            for (size_t b = 0; b < BATCH/2; ++b) {
+                const auto r = exponential_stream_.block( exponentials_.blocks_ + b );
+                exponentials_.values_[2*b]   = -std::log( to_unit(r[0], r[1]) );
+                exponentials_.values_[2*b+1] = -std::log( to_unit(r[2], r[3]) );
+            }
+            exponentials_.blocks_ += BATCH/2;
+            exponentials_.next_ = 0;
+        }
+        void fill_normals() {
+            //box-muller, one block gives a pair
+            for (size_t b = 0; b < BATCH/2; ++b) {
+                const auto r = normal_stream_.block( normals_.blocks_ + b );
+                const double radius = std::sqrt( -2*std::log( to_unit(r[0], r[1]) ) );
+                const double angle = 2*std::numbers::pi * to_unit(r[2], r[3]);
+                normals_.values_[2*b]   = radius * std::cos(angle);
+                normals_.values_[2*b+1] = radius * std::sin(angle);
+            }
+            normals_.blocks_ += BATCH/2;
+            normals_.next_ = 0;
+        }
+        template <typename IntType>
+            static IntType clip( const int k ) {
+                return k > std::numeric_limits<IntType>::max() ? std::numeric_limits<IntType>::max() : static_cast<IntType>(k);
+            }
+        void check_poisson_mean() const {
+            if (not (poisson_mean_ > 0))
+                throw std::runtime_error("poisson mean should be positive: " + std::to_string(poisson_mean_));
+        }
+        void fill_poissons() {
+            boost::random::poisson_distribution<int, double> d(poisson_mean_);
+            for (auto & k : poissons_.values_) k = d(poisson_engine_);
+            poissons_.next_ = 0;
+        }
+    };
+
+}
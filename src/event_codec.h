@@ -0,0 +1,352 @@
+#pragma once
+#include "sim.h"
+
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace SDB {
+
+    //compressed order book event files.
+    //  header : magic "SDBEVT1\0", uint8 flags (1: client ids), uint32 events per block.
+    //  blocks : uint32 number of events, uint32 byte length, int64 time of the first event, then the events.
+    //every event starts with one byte: bits 0-1 message type, bit 2 side, bits 3-4 how the order id is coded,
+    //bit 5 trade fields follow, bit 6 client id follows. then, as zigzagged LEB128 varints: the time as a delta
+    //from the previous event, the price as a delta from the previous price, the size, and when bit 5 is set the
+    //trade price as a delta from the price and the trade size. an order id is the previous one, the one after it
+    //(increment()), its low 8 bytes as a delta from the previous id with the high 4 bytes the same, or 12 raw
+    //bytes. a client id is written when it changes. every block starts from scratch, so blocks can be decoded
+    //independently; EventFileReader::index() finds them without decoding.
+    enum class OrderIDCode : uint8_t { Same = 0, Next = 1, Delta = 2, Raw = 3 };
+
+    inline void put_varint( std::vector<uint8_t> & bytes, uint64_t z ) {
+        while (z >= 0x80) {
+            bytes.push_back( static_cast<uint8_t>(z | 0x80) );
+            z >>= 7;
+        }
+        bytes.push_back( static_cast<uint8_t>(z) );
+    }
+    inline void put_zigzag( std::vector<uint8_t> & bytes, const int64_t x ) {
+        put_varint( bytes, (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63) );
+    }
+    inline uint64_t get_varint( const uint8_t * & p, const uint8_t * const end ) {
+        if (p != end and *p < 0x80) return *p++;
+        uint64_t z = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (p == end or shift > 63) throw std::runtime_error("Truncated varint in event block");
+            const uint8_t b = *p++;
+            z |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (b < 0x80) return z;
+        }
+    }
+    inline int64_t get_zigzag( const uint8_t * & p, const uint8_t * const end ) {
+        const uint64_t z = get_varint( p, end );
+        return static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+    }
+
+    //the low 8 bytes of an order id, byte 0 least significant as in increment()
+    inline uint64_t order_id_low( const OrderIDType & oid ) {
+        uint64_t x = 0;
+        for (size_t i = 8; i-- > 0; ) x = (x << 8) | oid[i];
+        return x;
+    }
+    inline void set_order_id_low( OrderIDType & oid, uint64_t x ) {
+        for (size_t i = 0; i < 8; ++i, x >>= 8) oid[i] = static_cast<uint8_t>(x);
+    }
+
+    //the events of one block
+    struct EventBlockEncoder {
+        static constexpr uint8_t SIDE_BIT = 0x04, OID_SHIFT = 3, TRADE_BIT = 0x20, CID_BIT = 0x40 ;
+
+        //data
+        std::vector<uint8_t> bytes_ ;
+        uint32_t n_ ;
+        TimeType first_time_, prev_time_ ;
+        int64_t prev_price_ ;
+        OrderIDType prev_oid_ ;
+        ClientIDType prev_cid_ ;
+
+        EventBlockEncoder() { clear(); }
+
+        void put( const TimeType event_time, const OrderIDType & oid, const int64_t price, const int64_t trade_price,
+                const int64_t size, const int64_t trade_size, const NotifyMessageType mtype, const Side side, const ClientIDType cid ) {
+            if (n_ == 0) first_time_ = prev_time_ = event_time;
+            OrderIDCode code = OrderIDCode::Raw;
+            if (oid == prev_oid_) code = OrderIDCode::Same;
+            else {
+                OrderIDType next = prev_oid_;
+                increment( next );
+                if (oid == next) code = OrderIDCode::Next;
+                else if (std::equal( oid.begin() + 8, oid.end(), prev_oid_.begin() + 8 )) code = OrderIDCode::Delta;
+            }
+            const bool trade = trade_price != 0 or trade_size != 0;
+            const bool new_cid = cid != prev_cid_;
+            bytes_.push_back( static_cast<uint8_t>( static_cast<uint8_t>(mtype) | (side == Side::Offer ? SIDE_BIT : 0) |
+                        (static_cast<uint8_t>(code) << OID_SHIFT) | (trade ? TRADE_BIT : 0) | (new_cid ? CID_BIT : 0) ) );
+            put_zigzag( bytes_, event_time - prev_time_ );
+            put_zigzag( bytes_, price - prev_price_ );
+            put_zigzag( bytes_, size );
+            if (trade) {
+                put_zigzag( bytes_, trade_price - price );
+                put_zigzag( bytes_, trade_size );
+            }
+            if (code == OrderIDCode::Delta)
+                put_zigzag( bytes_, static_cast<int64_t>( order_id_low(oid) - order_id_low(prev_oid_) ) );
+            else if (code == OrderIDCode::Raw)
+                bytes_.insert( bytes_.end(), oid.begin(), oid.end() );
+            if (new_cid) put_varint( bytes_, cid );
+            prev_time_ = event_time;
+            prev_price_ = price;
+            prev_oid_ = oid;
+            prev_cid_ = cid;
+            ++n_;
+        }
+        void clear() {
+            bytes_.clear();
+            n_ = 0;
+            first_time_ = prev_time_ = 0;
+            prev_price_ = 0;
+            prev_oid_.fill(0);
+            prev_cid_ = 0;
+        }
+    };
+
+    //f(event_time, oid, price, trade_price, size, trade_size, mtype, side, cid) for the n events of the block
+    //[p, end) of the first time first_time, the arguments of emplace_back()
+    template <typename F>
+        void decode_event_block( const uint8_t * p, const uint8_t * const end, const uint32_t n, const TimeType first_time, F && f ) {
+            TimeType t = first_time;
+            int64_t price = 0;
+            OrderIDType oid;
+            oid.fill(0);
+            ClientIDType cid = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                if (p == end) throw std::runtime_error("Truncated event block");
+                const uint8_t head = *p++;
+                if (head & 0x80) throw std::runtime_error("Bad event header in event block");
+                t += get_zigzag( p, end );
+                price += get_zigzag( p, end );
+                const int64_t size = get_zigzag( p, end );
+                int64_t trade_price = 0, trade_size = 0;
+                if (head & EventBlockEncoder::TRADE_BIT) {
+                    trade_price = price + get_zigzag( p, end );
+                    trade_size = get_zigzag( p, end );
+                }
+                switch (static_cast<OrderIDCode>( (head >> EventBlockEncoder::OID_SHIFT) & 3 )) {
+                    case OrderIDCode::Same : break;
+                    case OrderIDCode::Next : increment( oid ); break;
+                    case OrderIDCode::Delta : set_order_id_low( oid, order_id_low(oid) + static_cast<uint64_t>(get_zigzag( p, end )) ); break;
+                    case OrderIDCode::Raw :
+                        if (end - p < static_cast<std::ptrdiff_t>(oid.size())) throw std::runtime_error("Truncated order id in event block");
+                        std::memcpy( oid.data(), p, oid.size() );
+                        p += oid.size();
+                        break;
+                }
+                if (head & EventBlockEncoder::CID_BIT) cid = static_cast<ClientIDType>( get_varint( p, end ) );
+                f( t, static_cast<const OrderIDType &>(oid), static_cast<PriceType>(price), static_cast<PriceType>(trade_price),
+                        static_cast<SizeType>(size), static_cast<SizeType>(trade_size), static_cast<NotifyMessageType>(head & 3),
+                        (head & EventBlockEncoder::SIDE_BIT) ? Side::Offer : Side::Bid, cid );
+            }
+            if (p != end) throw std::runtime_error("Event block is longer than its events");
+        }
+
+    //writes order book events into a compressed file, block_events events per block
+    template <OBEConcept OBE = OrderBookEvent>
+        struct EventFileWriter {
+            static constexpr char MAGIC[8] = {'S','D','B','E','V','T','1','\0'} ;
+            static constexpr bool HAS_CID = requires ( const OBE & obe ) { obe.cid_; } ;
+
+            //data
+            std::ofstream out_ ;
+            const size_t block_events_ ;
+            EventBlockEncoder block_ ;
+            size_t n_blocks_ ; //blocks written so far
+            size_t n_written_ ; //events written so far
+            size_t n_bytes_ ; //bytes written so far
+
+            explicit EventFileWriter( const std::string & fname, const size_t block_events = 1 << 16 ) :
+                out_( fname, std::ios::out|std::ios::binary ), block_events_(block_events), n_blocks_(0), n_written_(0), n_bytes_(0) {
+                    if (not out_) throw std::runtime_error("Cannot open " + fname);
+                    if (block_events_ == 0 or block_events_ > std::numeric_limits<uint32_t>::max())
+                        throw std::runtime_error("block_events should be positive and fit in 32 bits");
+                    block_.bytes_.reserve( 8*block_events_ );
+                    out_.write( MAGIC, sizeof(MAGIC) );
+                    n_bytes_ += sizeof(MAGIC);
+                    write<uint8_t>( HAS_CID ? 1 : 0 );
+                    write<uint32_t>( block_events_ );
+                }
+            EventFileWriter( const EventFileWriter & ) = delete;
+            //the last block is written if finish() was not called. a failure is logged, not thrown.
+            ~EventFileWriter() {
+                try { finish(); }
+                catch (const std::exception & e) { SPDLOG_ERROR("EventFileWriter: {}", e.what()); }
+            }
+
+            void push( const OBE & e ) {
+                ClientIDType cid = 0;
+                if constexpr (HAS_CID) cid = e.cid_;
+                block_.put( e.event_time_, e.oid_, e.price_, e.trade_price_, e.size_, e.trade_size_, e.mtype_, e.side_, cid );
+                if (block_.n_ == block_events_) write_block();
+            }
+            template <typename Msgs>
+                void push_all( const Msgs & msgs ) {
+                    for (const auto & e : msgs) push( e );
+                }
+
+            //end of data: write the last, partial block. called by the destructor too; call it to see a failure.
+            void finish() {
+                if (block_.n_ > 0) write_block();
+                out_.flush();
+            }
+
+            private:
+            template <typename T, typename X>
+                void write( const X x ) {
+                    const T t = static_cast<T>(x);
+                    out_.write( reinterpret_cast<const char*>(&t), sizeof(t) );
+                    n_bytes_ += sizeof(t);
+                }
+            void write_block() {
+                write<uint32_t>( block_.n_ );
+                write<uint32_t>( block_.bytes_.size() );
+                write<int64_t>( block_.first_time_ );
+                out_.write( reinterpret_cast<const char*>(block_.bytes_.data()), block_.bytes_.size() );
+                if (not out_) throw std::runtime_error("EventFileWriter: write failed");
+                n_bytes_ += block_.bytes_.size();
+                n_written_ += block_.n_;
+                ++n_blocks_;
+                block_.clear();
+            }
+        };
+
+    //reads a file written by EventFileWriter block by block
+    struct EventFileReader {
+        struct BlockInfo {
+            std::streampos pos_ ; //of the block header
+            uint32_t n_ ;
+            TimeType first_time_ ;
+        };
+
+        //data
+        std::istream & in_ ;
+        bool has_cid_ ;
+        uint32_t block_events_ ;
+        std::streampos data_ ; //first block
+        std::vector<uint8_t> payload_ ;
+
+        explicit EventFileReader( std::istream & in ) : in_(in) {
+            char magic[sizeof(EventFileWriter<>::MAGIC)];
+            in_.read( magic, sizeof(magic) );
+            if (not in_ or std::memcmp(magic, EventFileWriter<>::MAGIC, sizeof(magic)) != 0)
+                throw std::runtime_error("Not an order book event file");
+            uint8_t flags = 0;
+            read( flags );
+            read( block_events_ );
+            if (not in_) throw std::runtime_error("Truncated order book event file");
+            has_cid_ = (flags & 1) != 0;
+            data_ = in_.tellg();
+        }
+
+        //decodes the next block, f as in decode_event_block(). false at the end of the file.
+        template <typename F>
+            bool next_block( F && f ) {
+                uint32_t n = 0, length = 0;
+                TimeType first_time = 0;
+                if (not read(n)) return false;
+                read( length );
+                read( first_time );
+                payload_.resize( length );
+                in_.read( reinterpret_cast<char*>(payload_.data()), length );
+                if (not in_) throw std::runtime_error("Truncated order book event file");
+                decode_event_block( payload_.data(), payload_.data() + length, n, first_time, std::forward<F>(f) );
+                return true;
+            }
+        //the events of the next block appended to out, a std::vector or an EventStore of events
+        template <typename Msgs>
+            bool read_block( Msgs & out ) {
+                return next_block( [&out]( auto... args ) { emplace_back( out, args... ); } );
+            }
+
+        //every block of the file, from the block headers. the next block read is the first one again.
+        std::vector<BlockInfo> index() {
+            std::vector<BlockInfo> blocks;
+            in_.clear();
+            in_.seekg( data_ );
+            BlockInfo b;
+            uint32_t length = 0;
+            for (b.pos_ = in_.tellg(); read(b.n_); b.pos_ = in_.tellg()) {
+                read( length );
+                read( b.first_time_ );
+                if (not in_) throw std::runtime_error("Truncated order book event file");
+                blocks.push_back( b );
+                in_.seekg( length, std::ios::cur );
+            }
+            seek( data_ );
+            return blocks;
+        }
+        //the next block read is the one at pos
+        void seek( const std::streampos pos ) {
+            in_.clear();
+            in_.seekg( pos );
+        }
+
+        private:
+        template <typename T>
+            bool read( T & x ) {
+                in_.read( reinterpret_cast<char*>(&x), sizeof(x) );
+                return static_cast<bool>(in_);
+            }
+    };
+
+    //the events of a file written by EventFileWriter one at a time, a block decoded at a time
+    template <OBEConcept OBE = OrderBookEvent>
+        struct FileEventSource {
+            //data
+            EventFileReader reader_ ;
+            std::vector<OBE> block_ ;
+            size_t next_ ;
+
+            explicit FileEventSource( std::istream & in ) : reader_(in), next_(0) {}
+
+            bool next( OBE & e ) {
+                while (next_ == block_.size()) {
+                    block_.clear();
+                    next_ = 0;
+                    if (not reader_.read_block( block_ )) return false;
+                }
+                e = block_[next_++];
+                return true;
+            }
+        };
+
+    //every event of a file written by EventFileWriter, in a std::vector or an EventStore
+    template <typename Msgs>
+        Msgs read_events( std::istream & in ) {
+            EventFileReader reader( in );
+            Msgs out;
+            while (reader.read_block( out )) {}
+            return out;
+        }
+
+    //the replay program of simulate_a for a file written by EventFileWriter, compiled block by block: the events
+    //are never all in memory, only the ops of the program.
+    template <OBEConcept OBE = OrderBookEvent>
+        ReplayProgram read_replay_program( std::istream & in, const ClientIDType default_cid_market ) {
+            EventFileReader reader( in );
+            ReplayProgram program;
+            std::vector<OBE> events;
+            while (reader.read_block( events )) {
+                //the events of the last time may go on in the next block
+                auto last = events.end();
+                while (last != events.begin() and (last - 1)->event_time_ == events.back().event_time_) --last;
+                program.add_groups( events.begin(), last, default_cid_market );
+                events.erase( events.begin(), last );
+            }
+            program.add_groups( events.begin(), events.end(), default_cid_market );
+            program.ops_.shrink_to_fit();
+            return program;
+        }
+
+}
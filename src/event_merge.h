@@ -0,0 +1,140 @@
+#pragma once
+#include "sim.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//several time ordered event sources read as one, without putting them together in memory: per session files,
+//our own order log next to the public feed. a source is anything with bool next(OBE &), false at the end:
+//RangeEventSource over a vector or an EventStore, FileEventSource (event_codec.h), or an EventMerge.
+//
+//  std::vector<AnyEventSource<OBE>> sources;
+//  sources.emplace_back( RangeEventSource( own.begin(), own.end() ) );
+//  sources.emplace_back( FileEventSource<OBE>( feed_file ) );
+//  EventMerge<OBE> merged( std::move(sources) );
+//  const auto program = ReplayProgram::compile_stream<OBE>( merged, 0 );
+//
+//events at the same time come in the order of their sources, and in their order within a source.
+
+namespace SDB {
+
+    template <typename It>
+        struct RangeEventSource {
+            //data
+            It it_, end_ ;
+
+            RangeEventSource( It begin, It end ) : it_(begin), end_(end) {}
+
+            template <typename OBE>
+                bool next( OBE & e ) {
+                    if (it_ == end_) return false;
+                    e = *it_;
+                    ++it_;
+                    return true;
+                }
+        };
+
+    //a source of any type, for merging sources of different types
+    template <OBEConcept OBE = OrderBookEvent>
+        struct AnyEventSource {
+            //data
+            std::function<bool(OBE &)> next_ ;
+
+            template <typename Source> requires (not std::is_same_v<Source, AnyEventSource>)
+                AnyEventSource( Source src ) {
+                    auto p = std::make_shared<Source>( std::move(src) );
+                    next_ = [p]( OBE & e ) { return p->next( e ); };
+                }
+            bool next( OBE & e ) { return next_( e ); }
+        };
+
+    //k-way merge on a loser tree: the next event costs log2(k) comparisons, one per level between the leaf of
+    //the source it came from and the root. one event per source is held.
+    template <OBEConcept OBE = OrderBookEvent, typename Source = AnyEventSource<OBE>>
+        struct EventMerge {
+            //data
+            std::vector<Source> sources_ ;
+            std::vector<OBE> heads_ ; //the next event of every source
+            std::vector<bool> live_ ; //false once the source is done
+            std::vector<uint32_t> losers_ ; //internal node n in 1..k-1 holds the loser there, leaves are k..2k-1
+            uint32_t winner_ ;
+            uint32_t source_ ; //of the event next() gave last
+
+            explicit EventMerge( std::vector<Source> sources ) :
+                sources_(std::move(sources)), heads_(sources_.size()), live_(sources_.size(), false),
+                losers_(sources_.size(), 0), winner_(0), source_(0) {
+                    if (sources_.size() >= std::numeric_limits<uint32_t>::max()) throw std::runtime_error("too many sources");
+                    const uint32_t k = static_cast<uint32_t>(sources_.size());
+                    for (uint32_t s = 0; s < k; ++s) live_[s] = sources_[s].next( heads_[s] );
+                    if (k == 0) return;
+                    //winners of the subtrees, bottom up
+                    std::vector<uint32_t> winners( 2*k );
+                    for (uint32_t s = 0; s < k; ++s) winners[k + s] = s;
+                    for (uint32_t n = k - 1; n >= 1; --n) {
+                        const uint32_t a = winners[2*n], b = winners[2*n + 1];
+                        winners[n] = before( a, b ) ? a : b;
+                        losers_[n] = before( a, b ) ? b : a;
+                    }
+                    winner_ = winners[1];
+                }
+
+            bool next( OBE & e ) {
+                if (sources_.empty() or not live_[winner_]) return false;
+                const uint32_t s = winner_;
+                e = heads_[s];
+                source_ = s;
+                live_[s] = sources_[s].next( heads_[s] );
+                if (live_[s] and heads_[s].event_time_ < e.event_time_)
+                    throw replay_error( "source " + std::to_string(s) + " goes back in time: " +
+                            std::to_string(heads_[s].event_time_) + " after " + std::to_string(e.event_time_) );
+                //replay the path of s
+                uint32_t w = s;
+                for (uint32_t n = (static_cast<uint32_t>(sources_.size()) + s) / 2; n >= 1; n /= 2)
+                    if (before( losers_[n], w )) std::swap( losers_[n], w );
+                winner_ = w;
+                return true;
+            }
+
+            private:
+            //a done source comes after everything
+            bool before( const uint32_t a, const uint32_t b ) const {
+                if (not live_[a]) return false;
+                if (not live_[b]) return true;
+                const auto ta = heads_[a].event_time_, tb = heads_[b].event_time_;
+                return ta < tb or (ta == tb and a < b);
+            }
+        };
+
+    //replays the market messages of src into eng a time at a time, with a book state after every step, as
+    //ReplayProgram::replay_group does. no shadow orders.
+    template <OBEConcept OBE, typename Source, typename SN>
+        void replay_stream( Source & src, const ClientIDType default_cid_market, MatchingEngine & eng, SN & handler ) {
+            ReplayProgram program;
+            std::vector<OBE> group;
+            auto flush = [&]() {
+                program.ops_.clear();
+                program.steps_.clear();
+                program.groups_.clear();
+                program.add_group( group.begin(), group.end(), default_cid_market );
+                program.replay_group( 0, eng, handler );
+                group.clear();
+            };
+            OBE m;
+            while (src.next( m )) {
+                if (not group.empty() and m.event_time_ != group.front().event_time_) {
+                    if (m.event_time_ < group.front().event_time_)
+                        throw replay_error( std::string("time order has failed: ") +
+                                std::to_string( m.event_time_ ) + " vs " + std::to_string( group.front().event_time_ ) );
+                    flush();
+                }
+                group.push_back( m );
+            }
+            if (not group.empty()) flush();
+        }
+
+}
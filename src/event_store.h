@@ -0,0 +1,274 @@
+#pragma once
+#include "ob.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+//append only storage in fixed size blocks: growing never copies what is stored already.
+//  ChunkedVector<T> : the vector interface RecordingSimulationHandler uses (emplace_back, back, iteration), for the
+//                     trade and weighted mid series.
+//  EventStore<OBE>  : order book events, column by column in every block (structure of arrays), so that there is no
+//                     padding between the 12 byte order id, the 8 byte time and the narrow fields. with DELTA_TIMES a
+//                     block keeps one full time and 4 byte offsets from it, and a new block is started when an offset
+//                     would not fit: a block covers at most ~4.3s, which only pays off for dense streams. iterating
+//                     gives events by value, put together from the columns, and every step looks its block up: it is
+//                     there for convenience. a Cursor (cursor_begin(), cursor_end()) keeps its block and reads one
+//                     field at a time from the columns, which is what ReplayProgram::compile walks. the columns of a
+//                     block can also be read directly.
+
+namespace SDB {
+
+    //random access iterator over c[i], for containers whose operator[] is the only way in
+    template <typename Container, typename Reference>
+    struct IndexIterator {
+        using iterator_category = std::random_access_iterator_tag ;
+        using value_type = typename Container::value_type ;
+        using difference_type = std::ptrdiff_t ;
+        using reference = Reference ;
+        //operator-> of iterators giving values
+        struct Arrow {
+            value_type value_ ;
+            const value_type * operator->() const { return &value_; }
+        };
+        using pointer = std::conditional_t< std::is_reference_v<Reference>, std::remove_reference_t<Reference> *, Arrow > ;
+
+        //data
+        Container * c_ = nullptr ;
+        difference_type i_ = 0 ;
+
+        reference operator*() const { return (*c_)[i_]; }
+        pointer operator->() const {
+            if constexpr (std::is_reference_v<Reference>) return &(*c_)[i_];
+            else return Arrow{ (*c_)[i_] };
+        }
+        reference operator[]( const difference_type n ) const { return (*c_)[i_ + n]; }
+        IndexIterator & operator++() { ++i_; return *this; }
+        IndexIterator & operator--() { --i_; return *this; }
+        IndexIterator operator++(int) { IndexIterator r = *this; ++i_; return r; }
+        IndexIterator operator--(int) { IndexIterator r = *this; --i_; return r; }
+        IndexIterator & operator+=( const difference_type n ) { i_ += n; return *this; }
+        IndexIterator & operator-=( const difference_type n ) { i_ -= n; return *this; }
+        friend IndexIterator operator+( IndexIterator it, const difference_type n ) { return it += n; }
+        friend IndexIterator operator+( const difference_type n, IndexIterator it ) { return it += n; }
+        friend IndexIterator operator-( IndexIterator it, const difference_type n ) { return it -= n; }
+        friend difference_type operator-( const IndexIterator & a, const IndexIterator & b ) { return a.i_ - b.i_; }
+        friend bool operator==( const IndexIterator & a, const IndexIterator & b ) { return a.i_ == b.i_; }
+        friend auto operator<=>( const IndexIterator & a, const IndexIterator & b ) { return a.i_ <=> b.i_; }
+    };
+
+    template <typename T, size_t BLOCK = 4096>
+    struct ChunkedVector {
+        using value_type = T ;
+        using Block = std::array<T, BLOCK> ;
+        using iterator = IndexIterator<ChunkedVector, T &> ;
+        using const_iterator = IndexIterator<const ChunkedVector, const T &> ;
+
+        //data
+        std::vector<std::unique_ptr<Block>> blocks_ ;
+        size_t size_ = 0 ;
+
+        template <typename... Args>
+            T & emplace_back( Args &&... args ) {
+                if (size_ == blocks_.size() * BLOCK) blocks_.emplace_back( std::make_unique<Block>() );
+                T & t = (*blocks_.back())[size_ % BLOCK];
+                t = T( std::forward<Args>(args)... );
+                ++size_;
+                return t;
+            }
+        void push_back( const T & t ) { emplace_back( t ); }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        void clear() { blocks_.clear(); size_ = 0; }
+        T & operator[]( const size_t i ) { return (*blocks_[i / BLOCK])[i % BLOCK]; }
+        const T & operator[]( const size_t i ) const { return (*blocks_[i / BLOCK])[i % BLOCK]; }
+        T & front() { return (*this)[0]; }
+        const T & front() const { return (*this)[0]; }
+        T & back() { return (*this)[size_ - 1]; }
+        const T & back() const { return (*this)[size_ - 1]; }
+        iterator begin() { return { this, 0 }; }
+        iterator end() { return { this, static_cast<std::ptrdiff_t>(size_) }; }
+        const_iterator begin() const { return { this, 0 }; }
+        const_iterator end() const { return { this, static_cast<std::ptrdiff_t>(size_) }; }
+        size_t bytes() const { return blocks_.size() * sizeof(Block); }
+
+        friend bool operator==( const ChunkedVector & a, const ChunkedVector & b ) {
+            return a.size_ == b.size_ and std::equal( a.begin(), a.end(), b.begin() );
+        }
+    };
+
+    template <typename OBE, bool DELTA_TIMES = false, size_t BLOCK = 4096>
+    struct EventStore {
+        using value_type = OBE ;
+        using Traits = typename OBE::traits_type ;
+        using PriceType = typename Traits::PriceType ;
+        using SizeType = typename Traits::SizeType ;
+        using TimeType = typename Traits::TimeType ;
+        using const_iterator = IndexIterator<const EventStore, OBE> ;
+        using iterator = const_iterator ;
+        static constexpr bool HAS_CID = requires ( const OBE & obe ) { obe.cid_; } ;
+
+        struct Block {
+            TimeType base_time_ ; //with DELTA_TIMES, times_ are offsets from it
+            uint32_t n_ = 0 ;
+            std::array<std::conditional_t<DELTA_TIMES, uint32_t, TimeType>, BLOCK> times_ ;
+            std::array<OrderIDType, BLOCK> oids_ ;
+            std::array<PriceType, BLOCK> prices_, trade_prices_ ;
+            std::array<SizeType, BLOCK> sizes_, trade_sizes_ ;
+            std::array<NotifyMessageType, BLOCK> mtypes_ ;
+            std::array<Side, BLOCK> sides_ ;
+            std::array<ClientIDType, HAS_CID ? BLOCK : 0> cids_ ;
+
+            TimeType time( const size_t i ) const {
+                if constexpr (DELTA_TIMES) return base_time_ + static_cast<TimeType>(times_[i]);
+                else return times_[i];
+            }
+            bool fits( const TimeType t ) const {
+                if (n_ == BLOCK) return false;
+                if constexpr (DELTA_TIMES)
+                    return n_ == 0 or (t >= base_time_ and static_cast<uint64_t>(t - base_time_) <= std::numeric_limits<uint32_t>::max());
+                else return true;
+            }
+            OBE get( const size_t i ) const {
+                OBE obe {};
+                obe.event_time_ = time(i);
+                obe.oid_ = oids_[i];
+                obe.price_ = prices_[i];
+                obe.trade_price_ = trade_prices_[i];
+                obe.size_ = sizes_[i];
+                obe.trade_size_ = trade_sizes_[i];
+                obe.mtype_ = mtypes_[i];
+                obe.side_ = sides_[i];
+                if constexpr (HAS_CID) obe.cid_ = cids_[i];
+                return obe;
+            }
+        };
+
+        //data
+        std::vector<std::unique_ptr<Block>> blocks_ ;
+        std::vector<size_t> ends_ ; //events up to the end of every block, only needed when blocks can close early
+        size_t size_ = 0 ;
+
+        void emplace_back( const TimeType event_time, const OrderIDType & oid, const PriceType price, const PriceType trade_price,
+                const SizeType size, const SizeType trade_size, const NotifyMessageType mtype, const Side side, const ClientIDType cid = 0 ) {
+            if (blocks_.empty() or not blocks_.back()->fits(event_time)) {
+                blocks_.emplace_back( std::make_unique<Block>() );
+                blocks_.back()->base_time_ = event_time;
+                if constexpr (DELTA_TIMES) ends_.push_back( size_ );
+            }
+            Block & b = *blocks_.back();
+            const uint32_t i = b.n_++;
+            if constexpr (DELTA_TIMES) {
+                b.times_[i] = static_cast<uint32_t>(event_time - b.base_time_);
+                ++ends_.back();
+            } else b.times_[i] = event_time;
+            b.oids_[i] = oid;
+            b.prices_[i] = price;
+            b.trade_prices_[i] = trade_price;
+            b.sizes_[i] = size;
+            b.trade_sizes_[i] = trade_size;
+            b.mtypes_[i] = mtype;
+            b.sides_[i] = side;
+            if constexpr (HAS_CID) b.cids_[i] = cid;
+            ++size_;
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        void clear() { blocks_.clear(); ends_.clear(); size_ = 0; }
+        size_t bytes() const { return blocks_.size() * sizeof(Block) + ends_.capacity() * sizeof(size_t); }
+
+        //block and position in it of event i
+        std::pair<const Block *, size_t> locate( const size_t i ) const {
+            if constexpr (DELTA_TIMES) {
+                const size_t b = std::upper_bound( ends_.begin(), ends_.end(), i ) - ends_.begin();
+                return { blocks_[b].get(), i - (b == 0 ? 0 : ends_[b-1]) };
+            } else return { blocks_[i / BLOCK].get(), i % BLOCK };
+        }
+        OBE operator[]( const size_t i ) const {
+            const auto [b, k] = locate(i);
+            return b->get(k);
+        }
+        TimeType time( const size_t i ) const {
+            const auto [b, k] = locate(i);
+            return b->time(k);
+        }
+        //a position that keeps its block and reads single fields from the columns, without putting an event
+        //together. a step is within the block, or on to the next one. cursors compare by their index in the store.
+        struct Cursor {
+            //data
+            const EventStore * store_ = nullptr ;
+            const Block * block_ = nullptr ;
+            size_t b_ = 0 ; //the index of block_
+            uint32_t k_ = 0 ; //in block_
+            size_t i_ = 0 ; //in the store
+
+            TimeType time() const { return block_->time(k_); }
+            const OrderIDType & oid() const { return block_->oids_[k_]; }
+            PriceType price() const { return block_->prices_[k_]; }
+            PriceType trade_price() const { return block_->trade_prices_[k_]; }
+            SizeType size() const { return block_->sizes_[k_]; }
+            SizeType trade_size() const { return block_->trade_sizes_[k_]; }
+            NotifyMessageType mtype() const { return block_->mtypes_[k_]; }
+            Side side() const { return block_->sides_[k_]; }
+            //default_cid when the events have none
+            ClientIDType cid( const ClientIDType default_cid ) const {
+                if constexpr (HAS_CID) return block_->cids_[k_];
+                else return default_cid;
+            }
+            OBE get() const { return block_->get(k_); }
+
+            Cursor & operator++() {
+                ++i_;
+                if (++k_ == block_->n_ and b_ + 1 < store_->blocks_.size()) {
+                    block_ = store_->blocks_[++b_].get();
+                    k_ = 0;
+                }
+                return *this;
+            }
+            friend bool operator==( const Cursor & a, const Cursor & b ) { return a.i_ == b.i_; }
+            friend auto operator<=>( const Cursor & a, const Cursor & b ) { return a.i_ <=> b.i_; }
+            friend std::ptrdiff_t operator-( const Cursor & a, const Cursor & b ) {
+                return static_cast<std::ptrdiff_t>(a.i_) - static_cast<std::ptrdiff_t>(b.i_);
+            }
+        };
+        Cursor cursor_begin() const { return { this, blocks_.empty() ? nullptr : blocks_.front().get(), 0, 0, 0 }; }
+        Cursor cursor_end() const { return { this, nullptr, 0, 0, size_ }; }
+
+        OBE front() const { return blocks_.front()->get(0); }
+        OBE back() const { return blocks_.back()->get( blocks_.back()->n_ - 1 ); }
+        const_iterator begin() const { return { this, 0 }; }
+        const_iterator end() const { return { this, static_cast<std::ptrdiff_t>(size_) }; }
+
+        //f(block) for every block, in order: the columns, without putting events together
+        template <typename F>
+            void for_each_block( F && f ) const {
+                for (const auto & b : blocks_) f( static_cast<const Block &>(*b) );
+            }
+    };
+
+    //same as emplace_back for the vectors of sim.h
+    template <typename OBE, bool DELTA_TIMES, size_t BLOCK>
+        void emplace_back( EventStore<OBE, DELTA_TIMES, BLOCK> & store,
+                const TimeType event_time,
+                const OrderIDType oid ,
+                const PriceType price,
+                const PriceType trade_price ,
+                const SizeType size,
+                const SizeType trade_size ,
+                const NotifyMessageType mtype ,
+                const Side side ,
+                const ClientIDType cid
+                ) {
+            store.emplace_back( event_time, oid, price, trade_price, size, trade_size, mtype, side, cid );
+        }
+
+}
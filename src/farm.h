@@ -0,0 +1,181 @@
+#pragma once
+
+#include <boost/random/mersenne_twister.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SDB {
+
+    //splitmix64 finalizer. turns (base seed, run index) into well separated seeds.
+    inline uint64_t mix64( uint64_t z ) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    inline uint32_t run_seed( const uint64_t base_seed, const uint64_t run_index ) {
+        const uint64_t z = mix64( base_seed + 0x9e3779b97f4a7c15ULL * (run_index + 1) );
+        return static_cast<uint32_t>( z ^ (z >> 32) );
+    }
+
+    //fixed size thread pool. every worker has its own queue, pops its newest task and
+    //steals the oldest task of another worker when its own queue is empty.
+    struct WorkStealingPool {
+        using Task = std::function<void()>;
+        struct Queue {
+            std::mutex m_ ;
+            std::deque<Task> tasks_ ;
+        };
+
+        //data
+        std::vector<std::unique_ptr<Queue>> queues_ ;
+        std::mutex m_ ;
+        std::condition_variable work_cv_, done_cv_ ;
+        size_t queued_ ; //tasks sitting in queues
+        size_t pending_ ; //tasks not finished yet
+        bool stop_ ;
+        std::atomic<size_t> next_queue_ ;
+        std::vector<std::jthread> workers_ ;
+
+        //ctor dtor
+        explicit WorkStealingPool( unsigned n_threads = 0 ) : queued_(0), pending_(0), stop_(false), next_queue_(0) {
+            if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned i = 0; i < n_threads; ++i) queues_.emplace_back( std::make_unique<Queue>() );
+            for (unsigned i = 0; i < n_threads; ++i) workers_.emplace_back( [this, i]() { work(i); } );
+        }
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> lock(m_);
+                stop_ = true;
+            }
+            work_cv_.notify_all();
+            workers_.clear(); //joins
+        }
+        WorkStealingPool( const WorkStealingPool & ) = delete;
+
+        size_t size() const { return queues_.size(); }
+
+        void submit( Task task ) {
+            Queue & q = *queues_[ next_queue_++ % queues_.size() ];
+            //counted before it is published, so that a worker taking it at once never takes the counters below 0
+            {
+                std::lock_guard<std::mutex> lock(m_);
+                ++queued_;
+                ++pending_;
+            }
+            {
+                std::lock_guard<std::mutex> lock(q.m_);
+                q.tasks_.push_back( std::move(task) );
+            }
+            work_cv_.notify_one();
+        }
+
+        //blocks until every submitted task has run
+        void wait() {
+            std::unique_lock<std::mutex> lock(m_);
+            done_cv_.wait( lock, [this]() { return pending_ == 0; } );
+        }
+
+        private:
+        bool pop( const size_t i, Task & task ) {
+            {
+                Queue & own = *queues_[i];
+                std::lock_guard<std::mutex> lock(own.m_);
+                if (not own.tasks_.empty()) {
+                    task = std::move(own.tasks_.back());
+                    own.tasks_.pop_back();
+                    return true;
+                }
+            }
+            for (size_t k = 1; k < queues_.size(); ++k) {
+                Queue & victim = *queues_[(i + k) % queues_.size()];
+                std::lock_guard<std::mutex> lock(victim.m_);
+                if (not victim.tasks_.empty()) {
+                    task = std::move(victim.tasks_.front());
+                    victim.tasks_.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work( const size_t i ) {
+            Task task;
+            while (true) {
+                if (pop(i, task)) {
+                    {
+                        std::lock_guard<std::mutex> lock(m_);
+                        --queued_;
+                    }
+                    task();
+                    task = nullptr;
+                    std::lock_guard<std::mutex> lock(m_);
+                    if (--pending_ == 0) done_cv_.notify_all();
+                } else {
+                    std::unique_lock<std::mutex> lock(m_);
+                    work_cv_.wait( lock, [this]() { return stop_ or queued_ > 0; } );
+                    if (stop_ and queued_ == 0) return;
+                }
+            }
+        }
+    };
+
+    struct MeanStd {
+        double mean_, std_ ;
+        size_t n_ ;
+    };
+
+    //mean and (population) std of xs, summed in order so the result does not depend on who computed xs.
+    inline MeanStd mean_std( const std::vector<double> & xs ) {
+        double sum = 0, sumsq = 0;
+        for (const double x : xs) {
+            sum += x;
+            sumsq += x*x;
+        }
+        const double n = static_cast<double>(xs.size());
+        const double m = sum/n;
+        return { m, std::sqrt( sumsq/n - m*m ), xs.size() };
+    }
+
+    //runs independent simulations on a thread pool. run k gets its own mt19937 seeded with
+    //run_seed(base_seed, k), so a run's result depends only on (base_seed, k), never on the
+    //thread count or the order the runs happen to execute in. results come back indexed by run.
+    struct ExperimentFarm {
+        const uint64_t base_seed_ ;
+        WorkStealingPool pool_ ;
+
+        explicit ExperimentFarm( const uint64_t base_seed, const unsigned n_threads = 0 ) :
+            base_seed_(base_seed), pool_(n_threads) {}
+
+        //Run : (size_t run_index, boost::random::mt19937 & mt) -> Result
+        template <typename Result, typename Run>
+            std::vector<Result> run( const size_t n_runs, Run && run ) {
+                std::vector<Result> results(n_runs);
+                std::vector<std::exception_ptr> errors(n_runs);
+                for (size_t k = 0; k < n_runs; ++k)
+                    pool_.submit( [this, k, &run, &results, &errors]() {
+                            try {
+                                boost::random::mt19937 mt( run_seed(base_seed_, k) );
+                                results[k] = run(k, mt);
+                            } catch (...) {
+                                errors[k] = std::current_exception();
+                            }
+                        } );
+                pool_.wait();
+                for (auto & e : errors)
+                    if (e) std::rethrow_exception(e);
+                return results;
+            }
+    };
+
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "ob.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//book and trade features kept up to date as the engine goes, in one vector whose layout is fixed when the
+//pipeline is made. FeaturePipeline is an INotifier: log(eng) after the book changes, the trades come through
+//log(mtype, ...). what is read from the book costs one step per level looked at, as the shown size of a level is
+//kept with it; what has a horizon (EMAs, variance, trade flow) is a running sum, updated when there is something new.
+//  MID, WM, MICROPRICE, SPREAD : from the best levels, NaN unless both sides have one
+//  imbalance(i) : (bid - ask)/(bid + ask) of the shown sizes within imbalance_ticks_[i] of the best prices, in [-1, 1]
+//  ema(i)       : EMA of wm with horizon ema_horizons_[i], as the EMA struct below
+//  variance()   : realised variance of wm per second, squared changes of wm over variance_horizon_
+//  flow()       : (bought - sold)/(bought + sold) by aggressive orders over flow_horizon_, in [-1, 1]
+
+namespace SDB {
+
+    //time weighted EMA of a piecewise constant x: x holds from the time it is given until the next one
+    struct EMA {
+        const double T_;
+        double x_prev_, t_prev_, ema_;
+        explicit EMA(const double T) : T_(T),
+                              x_prev_(std::numeric_limits<double>::quiet_NaN()),
+                              t_prev_(std::numeric_limits<double>::quiet_NaN()),
+                              ema_(std::numeric_limits<double>::quiet_NaN()) {
+        }
+        void update( const double & t, const double & x ) {
+            if (std::isnan(ema_))
+                ema_ = x;
+            else {
+                const double w = std::exp(-(t - t_prev_) / T_);
+                ema_ = w * ema_ + (1 - w) * x_prev_;
+            }
+            x_prev_ = x;
+            t_prev_ = t;
+        }
+    };
+
+    struct FeatureConfig {
+        std::vector<int64_t> imbalance_ticks_ { 0, 1, 4 } ;
+        std::vector<double> ema_horizons_ { 1, 10, 60 } ; //seconds
+        int64_t microprice_ticks_ = 2 ; //wm of the sizes within this many ticks of the best prices
+        double variance_horizon_ = 60 ; //seconds
+        double flow_horizon_ = 10 ; //seconds
+    };
+
+    struct FeaturePipeline {
+        enum : size_t { MID, WM, MICROPRICE, SPREAD, N_TOP };
+
+        //data
+        const FeatureConfig config_ ;
+        std::vector<double> values_ ;
+        std::vector<EMA> emas_ ;
+        double last_wm_ ; //for the variance
+        double sum_sq_ ; //of the changes of wm, decayed
+        int64_t variance_time_ ;
+        double bought_, sold_ ; //decayed
+        int64_t flow_time_ ;
+        size_t n_updates_, n_trades_ ;
+
+        explicit FeaturePipeline( FeatureConfig config = {} ) :
+            config_(std::move(config)),
+            values_(N_TOP + config_.imbalance_ticks_.size() + config_.ema_horizons_.size() + 2,
+                    std::numeric_limits<double>::quiet_NaN()),
+            last_wm_(std::numeric_limits<double>::quiet_NaN()), sum_sq_(0), variance_time_(0),
+            bought_(0), sold_(0), flow_time_(0), n_updates_(0), n_trades_(0) {
+                for (const auto k : config_.imbalance_ticks_)
+                    if (k < 0) throw std::runtime_error("imbalance ticks should not be negative: " + std::to_string(k));
+                if (config_.microprice_ticks_ < 0)
+                    throw std::runtime_error("microprice ticks should not be negative: " + std::to_string(config_.microprice_ticks_));
+                for (const auto T : config_.ema_horizons_) {
+                    if (not (T > 0)) throw std::runtime_error("EMA horizon should be positive: " + std::to_string(T));
+                    emas_.emplace_back( T );
+                }
+                if (not (config_.variance_horizon_ > 0) or not (config_.flow_horizon_ > 0))
+                    throw std::runtime_error("variance and flow horizons should be positive");
+            }
+
+        size_t size() const { return values_.size(); }
+        const double * data() const { return values_.data(); }
+        double operator[]( const size_t i ) const { return values_[i]; }
+        double wm() const { return values_[WM]; }
+        size_t imbalance( const size_t i ) const { return N_TOP + i; }
+        size_t ema( const size_t i ) const { return N_TOP + config_.imbalance_ticks_.size() + i; }
+        size_t variance() const { return values_.size() - 2; }
+        size_t flow() const { return values_.size() - 1; }
+
+        //column names, for exports
+        std::vector<std::string> names() const {
+            std::vector<std::string> ret { "mid", "wm", "microprice", "spread" };
+            for (const auto k : config_.imbalance_ticks_) ret.push_back( "imbalance" + std::to_string(k) );
+            for (const auto T : config_.ema_horizons_) ret.push_back( "ema" + std::to_string(T) );
+            ret.push_back( "variance" );
+            ret.push_back( "flow" );
+            return ret;
+        }
+
+        //aggressive orders are not in the book yet when they trade
+        template <typename O>
+            void log( const NotifyMessageType mtype, const O & o, const int64_t t, const int64_t trade_size = 0, const int64_t = 0 ) {
+                if (mtype != NotifyMessageType::Trade or o.is_shadow_ or o.level_ != nullptr) return;
+                const double w = std::exp( -1e-9*static_cast<double>(t - flow_time_) / config_.flow_horizon_ );
+                bought_ *= w;
+                sold_ *= w;
+                (o.side_ == Side::Bid ? bought_ : sold_) += static_cast<double>( std::abs(trade_size) );
+                flow_time_ = t;
+                values_[flow()] = (bought_ - sold_) / (bought_ + sold_);
+                ++n_trades_;
+            }
+        template <typename E>
+            void log( const E & eng ) {
+                ++n_updates_;
+                constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+                const auto & bids = eng.all_bids_;
+                const auto & offers = eng.all_offers_;
+                double wm = nan;
+                if (not bids.empty() and not offers.empty()) {
+                    const int64_t bp = bids.begin()->price_, bs = bids.begin()->total_shown();
+                    const int64_t ap = offers.begin()->price_, as = offers.begin()->total_shown();
+                    wm = bs + as ? double(bp*as + ap*bs)/double(bs + as) : nan;
+                    const int64_t b = eng.depth( Side::Bid, config_.microprice_ticks_ );
+                    const int64_t a = eng.depth( Side::Offer, config_.microprice_ticks_ );
+                    values_[MID] = 0.5*double(bp + ap);
+                    values_[MICROPRICE] = b + a ? double(bp*a + ap*b)/double(b + a) : nan;
+                    values_[SPREAD] = double(ap - bp);
+                } else
+                    values_[MID] = values_[MICROPRICE] = values_[SPREAD] = nan;
+                values_[WM] = wm;
+                for (size_t i = 0; i < config_.imbalance_ticks_.size(); ++i) {
+                    const int64_t b = eng.depth( Side::Bid, config_.imbalance_ticks_[i] );
+                    const int64_t a = eng.depth( Side::Offer, config_.imbalance_ticks_[i] );
+                    values_[imbalance(i)] = b + a ? double(b - a)/double(b + a) : nan;
+                }
+                if (std::isnan(wm)) return; //the EMAs and the variance go on from the last wm
+                const int64_t t = eng.time_;
+                for (size_t i = 0; i < emas_.size(); ++i) {
+                    emas_[i].update( 1e-9*static_cast<double>(t), wm );
+                    values_[ema(i)] = emas_[i].ema_;
+                }
+                if (not std::isnan(last_wm_)) {
+                    sum_sq_ *= std::exp( -1e-9*static_cast<double>(t - variance_time_) / config_.variance_horizon_ );
+                    sum_sq_ += (wm - last_wm_)*(wm - last_wm_);
+                    values_[variance()] = sum_sq_ / config_.variance_horizon_;
+                }
+                last_wm_ = wm;
+                variance_time_ = t;
+            }
+        static void error( const OrderIDType & , const std::string & ) {}
+    };
+
+}
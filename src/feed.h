@@ -0,0 +1,232 @@
+#pragma once
+#include "ob.h"
+
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//a binary market data feed in the shape of ITCH: fixed size little endian records, one per book event, every
+//one with a sequence number and a time. FeedWriter is an INotifier that writes what an engine does, replay_feed()
+//turns a feed back into add_replay_order/cancel_order calls on another engine, which ends with the same book.
+//  'A' add      : an order rests with size at price. an aggressive order is added for what is left of it after
+//                 it matched, the refill of an iceberg order is added again under the same order id.
+//  'E' execute  : a resting order traded size at price. the aggressive side of a trade is not written.
+//  'X' cancel   : size taken off a resting order, which keeps its place.
+//  'D' delete   : a resting order is cancelled.
+//  'U' replace  : a resting order is deleted and a new one added on its side, with the client of the old one.
+//the engine never reduces or replaces orders, FeedWriter writes A, E and D only. there is no header and no
+//framing beyond the type byte, records are back to back. prices and sizes are 32 bits: FeedWriter throws on an
+//engine whose numbers do not fit (WideSizeTraits sizes beyond 2^31).
+
+namespace SDB {
+
+    static_assert( std::endian::native == std::endian::little, "feed records are written as they are in memory" );
+
+    enum class FeedMessageType : char { Add = 'A', Execute = 'E', Cancel = 'X', Delete = 'D', Replace = 'U' };
+
+#pragma pack(push, 1)
+    struct FeedHeader {
+        FeedMessageType type_ ;
+        uint64_t seq_ ; //from 1, no gaps
+        int64_t time_ ;
+    };
+    struct FeedAdd {
+        FeedHeader h_ ;
+        OrderIDType oid_ ;
+        ClientIDType cid_ ;
+        int32_t price_ ;
+        int32_t size_ ;
+        Side side_ ;
+    };
+    struct FeedExecute {
+        FeedHeader h_ ;
+        OrderIDType oid_ ;
+        int32_t size_ ; //positive
+        int32_t price_ ;
+    };
+    struct FeedCancel {
+        FeedHeader h_ ;
+        OrderIDType oid_ ;
+        int32_t size_ ;
+    };
+    struct FeedDelete {
+        FeedHeader h_ ;
+        OrderIDType oid_ ;
+    };
+    struct FeedReplace {
+        FeedHeader h_ ;
+        OrderIDType oid_, new_oid_ ;
+        int32_t price_ ;
+        int32_t size_ ;
+    };
+#pragma pack(pop)
+    static_assert( sizeof(FeedAdd) == 42 and sizeof(FeedExecute) == 37 and sizeof(FeedCancel) == 33 and
+            sizeof(FeedDelete) == 29 and sizeof(FeedReplace) == 49 );
+
+    //INotifier writing the feed of an engine, for every engine width. records go into bytes_, which is written
+    //to out (when given) every flush_bytes. a new order is acked before it matches: it is held back until the
+    //engine is done with it, so flush() before reading bytes_. shadow orders are left out; a trade of a shadow
+    //order with a market order is written as an execution of the market order all the same.
+    struct FeedWriter {
+        //data
+        std::ostream * out_ ;
+        const size_t flush_bytes_ ;
+        std::vector<uint8_t> bytes_ ;
+        uint64_t seq_ ; //of the last record
+        size_t n_errors_ ;
+        FeedAdd pending_ ; //the new order, its size_ is what it shows after its trades so far
+        bool has_pending_ ;
+
+        explicit FeedWriter( std::ostream * out = nullptr, const size_t flush_bytes = 1 << 16 ) :
+            out_(out), flush_bytes_(flush_bytes), seq_(0), n_errors_(0), pending_{}, has_pending_(false) {
+                bytes_.reserve( out_ != nullptr ? flush_bytes_ + sizeof(FeedReplace) : flush_bytes_ );
+            }
+        FeedWriter( const FeedWriter & ) = delete;
+        //what is held back is written; a failure is logged, not thrown. call flush() to see it.
+        ~FeedWriter() {
+            try { if (out_ != nullptr) flush(); }
+            catch (const std::exception & e) { SPDLOG_ERROR("FeedWriter: {}", e.what()); }
+        }
+
+        template <typename O>
+            void log( const NotifyMessageType mtype, const O & o, const int64_t t, const int64_t trade_size = 0, const int64_t trade_price = 0 ) {
+                if (o.is_shadow_) return;
+                const bool resting = o.level_ != nullptr ; //trades of a resting order come before it leaves its level
+                const bool pending = has_pending_ and not resting and pending_.oid_ == o.order_id_ ;
+                switch (mtype) {
+                    case NotifyMessageType::Ack :
+                        if (o.is_refill_) {
+                            put( FeedAdd{ header(FeedMessageType::Add, t), o.order_id_, o.client_id_, field(o.price_, "price"),
+                                    field(o.shown_size_, "size"), o.side_ } );
+                            break;
+                        }
+                        if (not pending) add_pending();
+                        pending_ = FeedAdd{ { FeedMessageType::Add, 0, t }, o.order_id_, o.client_id_, field(o.price_, "price"),
+                                field(o.shown_size_, "size"), o.side_ };
+                        has_pending_ = true;
+                        break;
+                    case NotifyMessageType::Trade :
+                        if (resting)
+                            put( FeedExecute{ header(FeedMessageType::Execute, t), o.order_id_,
+                                    field(trade_size < 0 ? -trade_size : trade_size, "trade size"), field(trade_price, "trade price") } );
+                        else if (pending)
+                            pending_.size_ = field(o.shown_size_, "size");
+                        break;
+                    case NotifyMessageType::Cancel :
+                        add_pending();
+                        put( FeedDelete{ header(FeedMessageType::Delete, t), o.order_id_ } );
+                        break;
+                    case NotifyMessageType::End :
+                        if (pending and o.remaining_size_ == 0) has_pending_ = false;
+                        break;
+                }
+            }
+        template <typename E>
+            void log( const E & ) { add_pending(); }
+        void error( const OrderIDType & , const std::string & ) { ++n_errors_; }
+
+        //the held back order into bytes_, and bytes_ to out
+        void flush() {
+            add_pending();
+            write_out();
+        }
+
+        private:
+        //x in a 32 bit field of a record
+        static int32_t field( const int64_t x, const char * name ) {
+            if (x < std::numeric_limits<int32_t>::min() or x > std::numeric_limits<int32_t>::max())
+                throw std::runtime_error( fmt::format("FeedWriter: {} {} does not fit in a feed record", name, x) );
+            return static_cast<int32_t>(x);
+        }
+        FeedHeader header( const FeedMessageType type, const int64_t t ) { return { type, ++seq_, t }; }
+        void add_pending() {
+            if (not has_pending_) return;
+            has_pending_ = false;
+            if (pending_.size_ == 0) return;
+            pending_.h_ = header( FeedMessageType::Add, pending_.h_.time_ );
+            put( pending_ );
+        }
+        template <typename R>
+            void put( const R & r ) {
+                const size_t n = bytes_.size();
+                bytes_.resize( n + sizeof(r) );
+                std::memcpy( bytes_.data() + n, &r, sizeof(r) );
+                if (bytes_.size() >= flush_bytes_) write_out();
+            }
+        void write_out() {
+            if (out_ == nullptr or bytes_.empty()) return;
+            out_->write( reinterpret_cast<const char*>(bytes_.data()), bytes_.size() );
+            if (not *out_) throw std::runtime_error("FeedWriter: write failed");
+            bytes_.clear();
+        }
+    };
+
+    //f(record) for every record of [p, p + n), read in place: f is called with a FeedAdd, FeedExecute, FeedCancel,
+    //FeedDelete or FeedReplace. throws on an unknown type, a truncated record or a sequence gap. the number of
+    //records.
+    template <typename F>
+        size_t parse_feed( const uint8_t * p, const size_t n, F && f, uint64_t seq = 0 ) {
+            const uint8_t * const end = p + n;
+            size_t n_records = 0;
+            auto read = [&]<typename R>( R & r ) {
+                if (static_cast<size_t>(end - p) < sizeof(R))
+                    throw std::runtime_error( "Truncated feed record at " + std::to_string(n - (end - p)) );
+                std::memcpy( &r, p, sizeof(R) );
+                p += sizeof(R);
+                if (seq != 0 and r.h_.seq_ != seq + 1)
+                    throw std::runtime_error( "Feed sequence gap: " + std::to_string(seq) + " then " + std::to_string(r.h_.seq_) );
+                seq = r.h_.seq_;
+                ++n_records;
+                f( static_cast<const R &>(r) );
+            };
+            while (p != end) {
+                switch (static_cast<FeedMessageType>(*p)) {
+                    case FeedMessageType::Add : { FeedAdd r; read(r); break; }
+                    case FeedMessageType::Execute : { FeedExecute r; read(r); break; }
+                    case FeedMessageType::Cancel : { FeedCancel r; read(r); break; }
+                    case FeedMessageType::Delete : { FeedDelete r; read(r); break; }
+                    case FeedMessageType::Replace : { FeedReplace r; read(r); break; }
+                    default :
+                        throw std::runtime_error( "Unknown feed record type " + std::to_string(static_cast<int>(*p)) +
+                                " at " + std::to_string(n - (end - p)) );
+                }
+            }
+            return n_records;
+        }
+
+    //replays the feed [p, p + n) into eng. eng's time follows the records. executions and cancels take size off
+    //the order, which is cancelled when nothing is left, through notify. the number of records.
+    template <typename Traits, INotifier<Traits> N>
+        size_t replay_feed( const uint8_t * p, const size_t n, BasicMatchingEngine<Traits> & eng, N & notify ) {
+            using PriceType = typename Traits::PriceType ;
+            using SizeType = typename Traits::SizeType ;
+            auto at = [&eng]( const FeedHeader & h ) { if (h.time_ > eng.time_) eng.set_time( h.time_ ); };
+            return parse_feed( p, n, [&]<typename R>( const R & r ) {
+                    at( r.h_ );
+                    if constexpr (std::is_same_v<R, FeedAdd>)
+                        eng.add_replay_order( r.oid_, r.cid_, 0, static_cast<PriceType>(r.price_), static_cast<SizeType>(r.size_),
+                                r.side_, false, notify );
+                    else if constexpr (std::is_same_v<R, FeedExecute> or std::is_same_v<R, FeedCancel>)
+                        eng.reduce_order( r.oid_, static_cast<SizeType>(r.size_), notify );
+                    else if constexpr (std::is_same_v<R, FeedDelete>)
+                        eng.cancel_order( r.oid_, notify );
+                    else if constexpr (std::is_same_v<R, FeedReplace>) {
+                        auto it = eng.ptr_set_.find( r.oid_ );
+                        if (it == eng.ptr_set_.end()) {
+                            notify.error( r.oid_, std::to_string(eng.time_) + ": replacing an unknown order" );
+                            return;
+                        }
+                        const Side side = (*it)->side_;
+                        const ClientIDType cid = (*it)->client_id_;
+                        eng.cancel_order( r.oid_, notify );
+                        eng.add_replay_order( r.new_oid_, cid, 0, static_cast<PriceType>(r.price_), static_cast<SizeType>(r.size_),
+                                side, false, notify );
+                    }
+                } );
+        }
+
+}
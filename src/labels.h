@@ -0,0 +1,235 @@
+#pragma once
+#include "ob.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace SDB {
+
+    //labels describing how wm evolves after a row, within a horizon.
+    //all but stdev_ are relative to wm at the row.
+    struct WMLabels {
+        double last_, high_, low_, mean_, stdev_ ;
+        static WMLabels nan() {
+            constexpr double n = std::numeric_limits<double>::quiet_NaN();
+            return {n, n, n, n, n};
+        }
+    };
+
+    //streaming future-wm labeler for a single horizon.
+    //rows are pushed in time order. for a row with a valid wm, the window is the row itself and every later row
+    //with a valid wm and time < row time + horizon. rows with NaN wm get NaN labels.
+    //high/low come from monotonic deques, time weighted mean/stdev from running sums over the window, so
+    //every row is entered and retired once. labels come out in the same order rows go in,
+    //as soon as the window of a row is closed (or at finish()).
+    struct WMLabeler {
+        struct Point {
+            TimeType t_ ;
+            double wm_ ;
+            size_t row_ ; //global row index
+        };
+        struct Row {
+            bool done_ ;
+            WMLabels labels_ ;
+        };
+
+        //data
+        const TimeType horizon_ ;
+        double ref_ ; //wm offset to keep running sums small
+        std::deque<Point> points_ ; //points in the window of the head point
+        size_t points_base_ ; //global point index of points_.front()
+        std::deque<size_t> max_, min_ ; //global point indices, wm decreasing / increasing
+        double sum_wm_dt_, sum_wmsq_dt_ ; //over edges of the window, offset by ref_
+        size_t since_rebase_ ; //retirements since the sums were recomputed
+        double retired_dt_ ; //seconds of edges taken out of the sums since they were recomputed
+        std::deque<Row> rows_ ;
+        size_t rows_base_ ; //global row index of rows_.front()
+        size_t released_ ; //global rows before this are done
+
+        //methods
+        explicit WMLabeler( const TimeType horizon ) :
+            horizon_(horizon), ref_(std::numeric_limits<double>::quiet_NaN()),
+            points_base_(0), sum_wm_dt_(0), sum_wmsq_dt_(0), since_rebase_(0), retired_dt_(0), rows_base_(0), released_(0) {
+                if (horizon_ <= 0) throw std::runtime_error("horizon should be positive: " + std::to_string(horizon_));
+            }
+
+        void push( const TimeType t, const double wm ) {
+            const size_t row = rows_base_ + rows_.size();
+            if (std::isnan(wm)) {
+                rows_.push_back( {false, WMLabels::nan()} );
+                release_nan_rows();
+                return;
+            }
+            if (std::isnan(ref_)) ref_ = wm;
+            //close the windows that this point does not belong to:
+            while (not points_.empty() and t - points_.front().t_ >= horizon_)
+                retire_head();
+            rows_.push_back( {false, WMLabels::nan()} );
+            if (not points_.empty()) {
+                const Point & back = points_.back();
+                if (t < back.t_)
+                    throw std::runtime_error("WMLabeler: time is going back: " + std::to_string(t) + " < " + std::to_string(back.t_));
+                const double dt = 1e-9*static_cast<double>(t - back.t_);
+                const double x = back.wm_ - ref_;
+                sum_wm_dt_ += x*dt;
+                sum_wmsq_dt_ += x*x*dt;
+            }
+            const size_t index = points_base_ + points_.size();
+            points_.push_back( {t, wm, row} );
+            while (not max_.empty() and point(max_.back()).wm_ <= wm) max_.pop_back();
+            max_.push_back(index);
+            while (not min_.empty() and point(min_.back()).wm_ >= wm) min_.pop_back();
+            min_.push_back(index);
+        }
+
+        //end of data. remaining windows are truncated at the last row.
+        void finish() {
+            while (not points_.empty()) retire_head();
+        }
+
+        bool ready() const { return not rows_.empty() and rows_.front().done_ ; }
+        const WMLabels & front() const { return rows_.front().labels_ ; }
+        void pop() {
+            rows_.pop_front();
+            ++rows_base_;
+        }
+        size_t next_row() const { return rows_base_ ; }
+
+        private:
+        const Point & point( const size_t index ) const { return points_[index - points_base_]; }
+
+        //rows with NaN wm are done as soon as no earlier row is waiting
+        void release_nan_rows() {
+            const size_t first_open = points_.empty() ? rows_base_ + rows_.size() : points_.front().row_ ;
+            for ( ; released_ < first_open; ++released_) rows_[released_-rows_base_].done_ = true;
+        }
+
+        void retire_head() {
+            const Point & head = points_.front();
+            const Point & last = points_.back();
+            const double sum_dt = 1e-9*static_cast<double>(last.t_ - head.t_);
+            //the rounding error of the edges taken out is divided by sum_dt: recompute when they outweigh the window
+            if (retired_dt_ > sum_dt) rebase();
+            const double mean = sum_dt > 0 ? sum_wm_dt_ / sum_dt : std::numeric_limits<double>::quiet_NaN();
+            double var = sum_wmsq_dt_ / sum_dt - mean*mean ;
+            if (var < -EPS)
+                throw std::runtime_error(
+                        fmt::format("Negative var? sum mw : {}, sum sq mw : {}, sum dt : {}",
+                            sum_wm_dt_, sum_wmsq_dt_, sum_dt ) );
+            if (var < EPS) var = EPS;
+
+            Row & row = rows_[head.row_ - rows_base_];
+            row.labels_.last_  = last.wm_ - head.wm_ ;
+            row.labels_.high_  = point(max_.front()).wm_ - head.wm_ ;
+            row.labels_.low_   = point(min_.front()).wm_ - head.wm_ ;
+            row.labels_.mean_  = ref_ + mean - head.wm_ ;
+            row.labels_.stdev_ = std::sqrt(var) ;
+            row.done_ = true;
+
+            //remove the head point and its edge from the window:
+            if (points_.size() > 2) {
+                const double dt = 1e-9*static_cast<double>(points_[1].t_ - head.t_);
+                const double x = head.wm_ - ref_;
+                sum_wm_dt_ -= x*dt;
+                sum_wmsq_dt_ -= x*x*dt;
+                retired_dt_ += dt;
+            } else {
+                //no edges left, drop the rounding residue
+                sum_wm_dt_ = 0 ;
+                sum_wmsq_dt_ = 0 ;
+                retired_dt_ = 0 ;
+            }
+            if (max_.front() == points_base_) max_.pop_front();
+            if (min_.front() == points_base_) min_.pop_front();
+            points_.pop_front();
+            ++points_base_;
+            release_nan_rows();
+            //wm wanders away from ref_ and the running sums pick up rounding errors. re-anchor on the head
+            //and recompute exactly once the window has been turned over, which keeps it O(1) amortized. a window
+            //that became short next to what was retired is recomputed too, above.
+            if (++since_rebase_ >= std::max<size_t>(points_.size(), 64))
+                rebase();
+        }
+
+        void rebase() {
+            since_rebase_ = 0;
+            retired_dt_ = 0;
+            sum_wm_dt_ = 0;
+            sum_wmsq_dt_ = 0;
+            if (points_.empty()) return;
+            ref_ = points_.front().wm_;
+            for (size_t k = 1; k < points_.size(); ++k) {
+                const double dt = 1e-9*static_cast<double>(points_[k].t_ - points_[k-1].t_);
+                const double x = points_[k-1].wm_ - ref_;
+                sum_wm_dt_ += x*dt;
+                sum_wmsq_dt_ += x*x*dt;
+            }
+        }
+    };
+
+    //labels for rows [first, last) of a time ordered sequence of rows with time_ and wm_ members,
+    //for several horizons at once. windows may look past last, up to the end of rows.
+    //out[h][i-first] is the label of row i for horizons[h].
+    //the range is split in chunks that are labelled concurrently; each chunk runs its own labelers.
+    template <typename Rows>
+        void future_wm_labels(
+                const Rows & rows,
+                const size_t first, const size_t last,
+                const std::vector<TimeType> & horizons,
+                std::vector<std::vector<WMLabels>> & out,
+                unsigned n_threads = 0 ) {
+            if (first > last or last > rows.size())
+                throw std::runtime_error(fmt::format("bad row range [{}, {}) for {} rows", first, last, rows.size()));
+            out.assign( horizons.size(), std::vector<WMLabels>( last - first ) );
+            if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+            constexpr size_t min_chunk = 1 << 14 ;
+            const size_t n_chunks = std::max<size_t>(1, std::min<size_t>(n_threads, (last-first)/min_chunk) );
+            const size_t chunk = (last - first + n_chunks - 1) / n_chunks ;
+
+            auto label_chunk = [&](const size_t begin, const size_t end) {
+                for (size_t h = 0; h < horizons.size(); ++h) {
+                    WMLabeler labeler( horizons[h] );
+                    WMLabels * dst = out[h].data() + (begin - first);
+                    size_t i = begin;
+                    while (labeler.next_row() < end - begin) {
+                        if (i < rows.size())
+                            labeler.push( rows[i].time_, rows[i].wm_ );
+                        else
+                            labeler.finish();
+                        ++i;
+                        while (labeler.ready() and labeler.next_row() < end - begin) {
+                            dst[labeler.next_row()] = labeler.front();
+                            labeler.pop();
+                        }
+                    }
+                }
+            };
+
+            if (n_chunks == 1) {
+                label_chunk(first, last);
+                return;
+            }
+            std::vector<std::exception_ptr> errors(n_chunks);
+            {
+                std::vector<std::jthread> threads;
+                threads.reserve(n_chunks);
+                for (size_t c = 0; c < n_chunks; ++c) {
+                    const size_t begin = first + c*chunk;
+                    const size_t end = std::min(last, begin + chunk);
+                    if (begin < end) threads.emplace_back( [&, c, begin, end]() {
+                            try { label_chunk(begin, end); }
+                            catch (...) { errors[c] = std::current_exception(); }
+                            } );
+                }
+            }
+            for (auto & e : errors)
+                if (e) std::rethrow_exception(e);
+        }
+
+}
@@ -0,0 +1,181 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//per operation latency histograms of the matching engine. the hooks (SDB_LATENCY_TIMER/SDB_LATENCY_OP) are only
+//compiled in with -DSDB_LATENCY_STATS (cmake -DSDB_LATENCY_STATS=ON); without it they expand to nothing.
+//with it, a timed operation costs two tick reads and a counter increment in a thread local histogram.
+
+namespace SDB {
+
+    enum class LatencyOp : std::uint8_t {
+        AddOrderMatched, //add_order that traded against the book (it may rest the remainder)
+        AddOrderResting, //add_order that went straight into the book
+        CancelOrder,
+        LevelMatch, //one Level::match sweep
+        Level2,
+        Level25,
+        GetUnused, //MemoryManager
+        Free, //MemoryManager
+        N
+    };
+
+    inline const char * latency_op_name( const LatencyOp op ) {
+        constexpr std::array<const char *, static_cast<size_t>(LatencyOp::N)> names {
+            "add_order_matched", "add_order_resting", "cancel_order", "level_match",
+            "level2", "level25", "get_unused", "free" };
+        return names.at( static_cast<size_t>(op) );
+    }
+
+    //rdtsc where there is one, steady_clock otherwise. ticks are turned into nanoseconds only when reporting.
+    struct LatencyClock {
+        static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+        //measured once, against steady_clock
+        static double ns_per_tick() {
+            static const double r = []() {
+#if defined(__x86_64__) || defined(__i386__)
+                const auto t0 = std::chrono::steady_clock::now();
+                const uint64_t c0 = now();
+                std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+                const auto t1 = std::chrono::steady_clock::now();
+                const uint64_t c1 = now();
+                return std::chrono::duration<double, std::nano>(t1 - t0).count() / static_cast<double>(c1 - c0);
+#else
+                return 1e9 * std::chrono::steady_clock::period::num / std::chrono::steady_clock::period::den;
+#endif
+            }();
+            return r;
+        }
+    };
+
+    //log-linear histogram (HdrHistogram style): values below 2^SUB_BITS are exact, above that every power of two
+    //is split in 2^SUB_BITS buckets, so a reported value is within 1/2^SUB_BITS (~3%) of the recorded one.
+    struct LatencyHistogram {
+        static constexpr int SUB_BITS = 5 ;
+        static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS ;
+        static constexpr size_t N_BUCKETS = (64 - SUB_BITS + 1) * SUB ;
+
+        //data
+        std::array<uint64_t, N_BUCKETS> counts_ {} ;
+        uint64_t n_ = 0 ;
+        uint64_t max_ = 0 ;
+
+        static size_t index( const uint64_t v ) {
+            if (v < SUB) return v;
+            const int e = std::bit_width(v) - SUB_BITS - 1 ; //v is in [2^(e+SUB_BITS), 2^(e+SUB_BITS+1))
+            return (e + 1)*SUB + ((v >> e) - SUB);
+        }
+        //largest value that falls into bucket i
+        static uint64_t upper( const size_t i ) {
+            if (i < SUB) return i;
+            const int e = static_cast<int>(i / SUB) - 1;
+            const uint64_t m = i % SUB + SUB;
+            return ((m + 1) << e) - 1;
+        }
+
+        void record( const uint64_t v ) {
+            ++counts_[index(v)];
+            ++n_;
+            max_ = std::max(max_, v);
+        }
+        void merge( const LatencyHistogram & other ) {
+            for (size_t i = 0; i < N_BUCKETS; ++i) counts_[i] += other.counts_[i];
+            n_ += other.n_;
+            max_ = std::max(max_, other.max_);
+        }
+        void clear() { *this = LatencyHistogram(); }
+
+        //value at quantile q in [0, 1], 0 when empty
+        uint64_t quantile( const double q ) const {
+            if (n_ == 0) return 0;
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>( std::ceil(q * static_cast<double>(n_)) ));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < N_BUCKETS; ++i)
+                if ((seen += counts_[i]) >= rank) return std::min(upper(i), max_);
+            return max_;
+        }
+    };
+
+    struct LatencySummary {
+        uint64_t n_ ;
+        double p50_, p99_, p999_, max_ ; //nanoseconds
+    };
+
+    struct LatencyStats {
+        std::array<LatencyHistogram, static_cast<size_t>(LatencyOp::N)> histograms_ ;
+
+        LatencyHistogram & operator[]( const LatencyOp op ) { return histograms_[static_cast<size_t>(op)]; }
+        const LatencyHistogram & operator[]( const LatencyOp op ) const { return histograms_[static_cast<size_t>(op)]; }
+
+        void merge( const LatencyStats & other ) {
+            for (size_t i = 0; i < histograms_.size(); ++i) histograms_[i].merge( other.histograms_[i] );
+        }
+        void clear() { for (auto & h : histograms_) h.clear(); }
+
+        LatencySummary summary( const LatencyOp op ) const {
+            const LatencyHistogram & h = (*this)[op];
+            const double k = LatencyClock::ns_per_tick();
+            return { h.n_, k*h.quantile(.5), k*h.quantile(.99), k*h.quantile(.999), k*h.max_ };
+        }
+
+        //one line per operation that was recorded at least once
+        void dump( std::ostream & out ) const {
+            char line[160];
+            std::snprintf( line, sizeof(line), "%-18s %10s %11s %11s %11s %11s\n", "op", "n", "p50ns", "p99ns", "p99.9ns", "maxns" );
+            out << line;
+            for (size_t i = 0; i < histograms_.size(); ++i) {
+                const LatencyOp op = static_cast<LatencyOp>(i);
+                const LatencySummary s = summary(op);
+                if (s.n_ == 0) continue;
+                std::snprintf( line, sizeof(line), "%-18s %10llu %11.1f %11.1f %11.1f %11.1f\n",
+                        latency_op_name(op), static_cast<unsigned long long>(s.n_), s.p50_, s.p99_, s.p999_, s.max_ );
+                out << line;
+            }
+        }
+
+        //stats of the calling thread. the engine and its memory manager record here.
+        static LatencyStats & thread_instance() {
+            thread_local LatencyStats stats;
+            return stats;
+        }
+    };
+
+    //records the ticks between construction and destruction under op_, which can be changed until then.
+    struct LatencyTimer {
+        LatencyOp op_ ;
+        const uint64_t t0_ ;
+        explicit LatencyTimer( const LatencyOp op ) : op_(op), t0_(LatencyClock::now()) {}
+        ~LatencyTimer() { LatencyStats::thread_instance()[op_].record( LatencyClock::now() - t0_ ); }
+        LatencyTimer( const LatencyTimer & ) = delete;
+    };
+
+}
+
+#ifdef SDB_LATENCY_STATS
+#define SDB_LATENCY_TIMER(name, op) ::SDB::LatencyTimer name( ::SDB::LatencyOp::op )
+#define SDB_LATENCY_OP(name, op) (name.op_ = ::SDB::LatencyOp::op)
+#else
+#define SDB_LATENCY_TIMER(name, op)
+#define SDB_LATENCY_OP(name, op) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+#pragma once
+#include "ob.h"
+
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace SDB {
+
+    //columnar market state files.
+    //  header : magic "SDBCOL1\0", uint32 number of columns, then per column uint8 encoding, uint8 name length, name.
+    //  blocks : uint32 number of rows, uint32 byte length of every column, then the column payloads back to back.
+    //integer columns are delta encoded within a block, zigzagged and written as LEB128 varints; floating point
+    //columns are raw little endian. every block starts from scratch, so blocks can be decoded independently.
+    //py/market_states.py memory maps these files into numpy arrays.
+    enum class ColumnEncoding : uint8_t { DeltaVarint = 0, F64 = 1, F32 = 2 };
+
+    struct Column {
+        //data
+        std::string name_ ;
+        ColumnEncoding encoding_ ;
+        std::vector<uint8_t> bytes_ ; //current block
+        int64_t prev_ ;
+
+        Column( std::string name, const ColumnEncoding encoding ) : name_(std::move(name)), encoding_(encoding), prev_(0) {}
+
+        void put( const int64_t x ) {
+            const int64_t d = x - prev_;
+            prev_ = x;
+            uint64_t z = (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63);
+            while (z >= 0x80) {
+                bytes_.push_back( static_cast<uint8_t>(z | 0x80) );
+                z >>= 7;
+            }
+            bytes_.push_back( static_cast<uint8_t>(z) );
+        }
+        template <typename Float>
+            void put_raw( const Float x ) {
+                const size_t n = bytes_.size();
+                bytes_.resize( n + sizeof(x) );
+                std::memcpy( bytes_.data() + n, &x, sizeof(x) );
+            }
+        void clear() {
+            bytes_.clear();
+            prev_ = 0;
+        }
+    };
+
+    //MarketSink writing market states into a columnar file, block_rows rows per block.
+    //columns: time, wm, bid/ask prices, bid/ask sizes, bid/ask ages, one column per level.
+    struct MarketStateRecorder {
+        static constexpr char MAGIC[8] = {'S','D','B','C','O','L','1','\0'} ;
+        static constexpr size_t N_LEVELS = std::tuple_size_v<decltype(MarketState::bid_prices_)> ;
+
+        //data
+        std::ofstream out_ ;
+        const size_t block_rows_ ;
+        std::vector<Column> columns_ ;
+        size_t n_rows_ ; //rows in the current block
+        size_t n_blocks_ ; //blocks written so far
+        size_t n_written_ ; //rows written so far
+
+        explicit MarketStateRecorder( const std::string & fname, const size_t block_rows = 1 << 16 ) :
+            out_( fname, std::ios::out|std::ios::binary ), block_rows_(block_rows), n_rows_(0), n_blocks_(0), n_written_(0) {
+                if (not out_) throw std::runtime_error("Cannot open " + fname);
+                if (block_rows_ == 0) throw std::runtime_error("block_rows should be positive");
+                columns_.emplace_back( "time", ColumnEncoding::DeltaVarint );
+                columns_.emplace_back( "wm", ColumnEncoding::F64 );
+                for (const char * name : {"bid_price", "ask_price", "bid_size", "ask_size"})
+                    for (size_t k = 0; k < N_LEVELS; ++k)
+                        columns_.emplace_back( fmt::format("{}_{}", name, k), ColumnEncoding::DeltaVarint );
+                for (const char * name : {"bid_age", "ask_age"})
+                    for (size_t k = 0; k < N_LEVELS; ++k)
+                        columns_.emplace_back( fmt::format("{}_{}", name, k), ColumnEncoding::F32 );
+                for (auto & c : columns_) c.bytes_.reserve( 2*block_rows_ );
+
+                out_.write( MAGIC, sizeof(MAGIC) );
+                write<uint32_t>( columns_.size() );
+                for (const auto & c : columns_) {
+                    write<uint8_t>( static_cast<uint8_t>(c.encoding_) );
+                    write<uint8_t>( c.name_.size() );
+                    out_.write( c.name_.data(), c.name_.size() );
+                }
+            }
+        MarketStateRecorder( const MarketStateRecorder & ) = delete;
+
+        void push( const MarketState & m ) {
+            Column * c = columns_.data();
+            (c++)->put( m.time_ );
+            (c++)->put_raw( m.wm_ );
+            for (const auto x : m.bid_prices_) (c++)->put( x );
+            for (const auto x : m.ask_prices_) (c++)->put( x );
+            for (const auto x : m.bid_sizes_)  (c++)->put( x );
+            for (const auto x : m.ask_sizes_)  (c++)->put( x );
+            for (const auto x : m.bid_ages_)   (c++)->put_raw( x );
+            for (const auto x : m.ask_ages_)   (c++)->put_raw( x );
+            if (++n_rows_ == block_rows_) write_block();
+        }
+
+        //end of data: write the last, partial block.
+        void finish() {
+            if (n_rows_ > 0) write_block();
+            out_.flush();
+        }
+
+        private:
+        template <typename T>
+            void write( const size_t x ) {
+                const T t = static_cast<T>(x);
+                out_.write( reinterpret_cast<const char*>(&t), sizeof(t) );
+            }
+        void write_block() {
+            write<uint32_t>( n_rows_ );
+            for (const auto & c : columns_) write<uint32_t>( c.bytes_.size() );
+            for (auto & c : columns_) {
+                out_.write( reinterpret_cast<const char*>(c.bytes_.data()), c.bytes_.size() );
+                c.clear();
+            }
+            if (not out_) throw std::runtime_error("MarketStateRecorder: write failed");
+            n_written_ += n_rows_;
+            n_rows_ = 0;
+            ++n_blocks_;
+        }
+    };
+
+    //reads a file written by MarketStateRecorder back into market states
+    inline std::vector<MarketState> read_market_states( std::istream & in ) {
+        auto read = [&in]<typename T>( T & x ) {
+            in.read( reinterpret_cast<char*>(&x), sizeof(x) );
+            return static_cast<bool>(in);
+        };
+        char magic[sizeof(MarketStateRecorder::MAGIC)];
+        in.read( magic, sizeof(magic) );
+        if (not in or std::memcmp(magic, MarketStateRecorder::MAGIC, sizeof(magic)) != 0)
+            throw std::runtime_error("Not a market state file");
+        uint32_t n_columns = 0;
+        read(n_columns);
+        std::vector<ColumnEncoding> encodings(n_columns);
+        for (auto & e : encodings) {
+            uint8_t enc = 0, length = 0;
+            read(enc);
+            read(length);
+            e = static_cast<ColumnEncoding>(enc);
+            in.ignore(length);
+        }
+        constexpr size_t N = MarketStateRecorder::N_LEVELS;
+        if (n_columns != 2 + 6*N) throw std::runtime_error(fmt::format("Unexpected number of columns: {}", n_columns));
+
+        std::vector<MarketState> out;
+        uint32_t n_rows = 0;
+        std::vector<uint32_t> lengths(n_columns);
+        std::vector<std::vector<uint8_t>> payloads(n_columns);
+        while (read(n_rows)) {
+            for (auto & l : lengths) read(l);
+            for (uint32_t j = 0; j < n_columns; ++j) {
+                const size_t raw = encodings[j] == ColumnEncoding::F64 ? sizeof(double) :
+                    encodings[j] == ColumnEncoding::F32 ? sizeof(float) : 0 ;
+                if (raw != 0 and lengths[j] != n_rows*raw)
+                    throw std::runtime_error(fmt::format("Column {} has {} bytes for {} rows", j, lengths[j], n_rows));
+                payloads[j].resize(lengths[j]);
+                in.read( reinterpret_cast<char*>(payloads[j].data()), lengths[j] );
+            }
+            if (not in) throw std::runtime_error("Truncated market state file");
+            const size_t first = out.size();
+            out.resize( first + n_rows );
+            for (uint32_t j = 0; j < n_columns; ++j) {
+                const uint8_t * p = payloads[j].data();
+                const uint8_t * end = p + lengths[j];
+                int64_t prev = 0;
+                for (size_t i = first; i < out.size(); ++i) {
+                    MarketState & m = out[i];
+                    int64_t x = 0;
+                    double f = 0;
+                    switch (encodings[j]) {
+                        case ColumnEncoding::DeltaVarint : {
+                            uint64_t z = 0;
+                            for (int shift = 0; ; shift += 7) {
+                                if (p == end) throw std::runtime_error("Truncated varint column");
+                                const uint8_t b = *p++;
+                                z |= static_cast<uint64_t>(b & 0x7f) << shift;
+                                if (b < 0x80) break;
+                            }
+                            prev += static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+                            x = prev;
+                            break;
+                        }
+                        case ColumnEncoding::F64 : {
+                            std::memcpy(&f, p, sizeof(double));
+                            p += sizeof(double);
+                            break;
+                        }
+                        case ColumnEncoding::F32 : {
+                            float ff;
+                            std::memcpy(&ff, p, sizeof(float));
+                            p += sizeof(float);
+                            f = ff;
+                            break;
+                        }
+                    }
+                    if (j == 0) m.time_ = x;
+                    else if (j == 1) m.wm_ = f;
+                    else if (j < 2 + N)   m.bid_prices_[j-2]     = static_cast<PriceType>(x);
+                    else if (j < 2 + 2*N) m.ask_prices_[j-2-N]   = static_cast<PriceType>(x);
+                    else if (j < 2 + 3*N) m.bid_sizes_[j-2-2*N]  = static_cast<SizeType>(x);
+                    else if (j < 2 + 4*N) m.ask_sizes_[j-2-3*N]  = static_cast<SizeType>(x);
+                    else if (j < 2 + 5*N) m.bid_ages_[j-2-4*N]   = static_cast<float>(f);
+                    else                  m.ask_ages_[j-2-5*N]   = static_cast<float>(f);
+                }
+            }
+        }
+        return out;
+    }
+
+}
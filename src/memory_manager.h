@@ -4,6 +4,9 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/unordered_set_hook.hpp>
 
+#include "latency.h"
+
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -38,9 +41,10 @@ namespace SDB {
             list_type free_;
             std::vector<buffer_array*> mem_ ; 
             int64_t used_ ;
+            int64_t max_used_ ; //high-water mark of used_
             //methods
 
-            MemoryManager(const int N=2*1024*1024 ) : used_(0) {
+            MemoryManager(const int N=2*1024*1024 ) : used_(0), max_used_(0) {
                     int p = 0;
                     int n = N;
                     while (n>1) { 
@@ -67,17 +71,20 @@ namespace SDB {
             }
 
             T & get_unused() {
+                SDB_LATENCY_TIMER(timer, GetUnused);
                 if (free_.empty()) increase_mem();
                 T & t = free_.front();
                 t.clear();
                 free_.erase(free_.iterator_to(t));
                 used_ += 1;
+                max_used_ = std::max(max_used_, used_);
                 //std::cout << "using. used: " <<   used_ << std::endl;
                 return t;
             }
 
 
             void free(T & t) { 
+                SDB_LATENCY_TIMER(timer, Free);
                 t.clear();
                 free_.push_front(t);
                 used_ -= 1;
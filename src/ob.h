@@ -2,9 +2,13 @@
 #include <set>
 #include <array>
 #include <cstdint>
+#include <cstdlib>
 #include <format>
 #include <stdexcept>
+#include <type_traits>
 #include <unordered_set>
+#include <utility>
+#include <iterator>
 #include <limits>
 #include <sstream>
 #include <boost/container_hash/hash.hpp>
@@ -12,15 +16,10 @@
 #include <iomanip>
 
 
-#ifdef SPDLOG_ACTIVE_LEVEL 
-#undef SPDLOG_ACTIVE_LEVEL 
-#endif
-#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
-#ifndef SPDLOG_DEBUG_ON
-#define SPDLOG_DEBUG_ON
-#endif
-#ifndef SPDLOG_TRACE_ON
-#define SPDLOG_TRACE_ON
+//SPDLOG_TRACE/SPDLOG_DEBUG sit on hot paths and are compiled out unless the build asks for them,
+//e.g. with -DSPDLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_TRACE
+#ifndef SPDLOG_ACTIVE_LEVEL
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
 #endif
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bin_to_hex.h>
@@ -68,11 +67,31 @@ namespace SDB {
     }
 
     using OrderIDType = std::array<std::uint8_t, 12>  ; 
-    using TimeType = int64_t ; 
     using ClientIDType = uint32_t;
     using LocalOrderIDType = uint32_t;
-    using PriceType = int16_t;
-    using SizeType = int16_t;
+
+    //integer widths of the engine types (BasicOrder, BasicLevel, BasicMatchingEngine, BasicMarketState).
+    //narrow fields pack more orders per cache line, wide ones are for instruments whose prices or sizes
+    //do not fit in 16 bits. sizes are signed: offers report traded sizes negated.
+    template <typename Price, typename Size, typename Time = int64_t>
+        struct EngineTraits {
+            using PriceType = Price ;
+            using SizeType = Size ;
+            using TimeType = Time ;
+            static_assert( std::is_signed_v<Price> and std::is_signed_v<Size> and std::is_signed_v<Time> );
+        };
+    using NarrowTraits = EngineTraits<int16_t, int16_t> ;
+    using WideTraits = EngineTraits<int32_t, int32_t> ;
+    using WideSizeTraits = EngineTraits<int32_t, int64_t> ;
+    //what Order, Level, MatchingEngine, MarketState and the simulation code use; -DSDB_WIDE_ENGINE picks WideTraits
+#ifdef SDB_WIDE_ENGINE
+    using DefaultTraits = WideTraits ;
+#else
+    using DefaultTraits = NarrowTraits ;
+#endif
+    using TimeType = DefaultTraits::TimeType ; 
+    using PriceType = DefaultTraits::PriceType ;
+    using SizeType = DefaultTraits::SizeType ;
 
 } 
 namespace std {
@@ -99,7 +118,7 @@ namespace std {
 namespace SDB{
     inline std::string format_as( const NotifyMessageType & message) { return std::to_string(message); }
     inline std::string format_as( const Side & side) { return std::to_string(side); }
-    inline Side get_other_side( Side s ) {
+    constexpr Side get_other_side( Side s ) {
         switch (s) {
             case Side::Bid : return Side::Offer ;
             case Side::Offer : return Side::Bid ; 
@@ -129,11 +148,13 @@ namespace SDB{
                 increment(oid);
         }
 
-    struct Order;
-    struct MatchingEngine ;
-    template <typename T>
-        concept INotifier = requires( T & notifier, const NotifyMessageType mtype, const Order & o, const TimeType now, 
-                const SizeType traded_size, const PriceType traded_price , const MatchingEngine & eng,
+    template <typename Traits> struct BasicOrder;
+    template <typename Traits> struct BasicLevelQueue;
+    template <typename Traits> struct BasicMatchingEngine ;
+    template <typename T, typename Traits = DefaultTraits>
+        concept INotifier = requires( T & notifier, const NotifyMessageType mtype, const BasicOrder<Traits> & o,
+                const typename Traits::TimeType now, const typename Traits::SizeType traded_size,
+                const typename Traits::PriceType traded_price , const BasicMatchingEngine<Traits> & eng,
                 const OrderIDType & oid, const std::string & error_message)
         {
             notifier.log( mtype, o, now , traded_size, traded_price ) ;
@@ -141,9 +162,12 @@ namespace SDB{
             notifier.error( oid, error_message ) ;
         };
 
+    //a notifier for every engine width
     struct NOOPNotify {
-        static void log( const NotifyMessageType , const Order & , const TimeType, const SizeType = 0, const PriceType = 0) {}
-        static void log( const MatchingEngine & ) {}
+        template <typename O>
+            static void log( const NotifyMessageType , const O & , const int64_t, const int64_t = 0, const int64_t = 0) {}
+        template <typename E>
+            static void log( const E & ) {}
         static void error( const OrderIDType & , const std::string & ) {}
         static NOOPNotify & instance(){ 
             static NOOPNotify n; 
@@ -151,9 +175,26 @@ namespace SDB{
         }
     };
 
+    //two notifiers as one: a logger and a FeaturePipeline, say. a_ hears everything first.
+    template <typename A, typename B>
+        struct TeeNotify {
+            A & a_ ;
+            B & b_ ;
+            template <typename... Args>
+                void log( const Args &... args ) { a_.log( args... ); b_.log( args... ); }
+            void error( const OrderIDType & oid, const std::string & msg ) { a_.error( oid, msg ); b_.error( oid, msg ); }
+        };
+
     //inline void NOOPNotify( const NotifyMessageType , const Order & , const TimeType, const SizeType = 0, const PriceType = 0) { };
 
-    struct Order : public MemoryManaged{
+    template <typename Traits>
+    struct BasicOrder : public MemoryManaged{
+        using PriceType = typename Traits::PriceType ;
+        using SizeType = typename Traits::SizeType ;
+        using TimeType = typename Traits::TimeType ;
+        //the orders_ of a level, same type as MemoryManager<BasicOrder>::list_type
+        using LevelList = boost::intrusive::list< BasicOrder, boost::intrusive::constant_time_size<true> >;
+
         OrderIDType order_id_ ; 
         TimeType creation_time_ ; 
         ClientIDType client_id_ ;
@@ -166,9 +207,11 @@ namespace SDB{
         Side side_ ; 
         bool is_shadow_ ;  //for simulation and strategy testing
         mutable bool is_hidden_ ; //this will be set by an observer who doesn't know total size or remaining size.
+        const BasicLevelQueue<Traits> * level_ ; //the level the order rests in, nullptr when it is not in a book. levels are set nodes and don't move.
+        bool is_refill_ ; //true while the Ack of a refill is notified: the order rests, and shows again at the back of its level
 
 
-        template <INotifier N>
+        template <INotifier<Traits> N>
             void reset( TimeType t, ClientIDType cid, LocalOrderIDType local_id, PriceType p, SizeType s, SizeType show, Side side, bool is_shadow, N & notify ) 
             {
                 order_id_.fill( std::numeric_limits<std::uint8_t>::max() ) ;
@@ -183,9 +226,11 @@ namespace SDB{
                 side_ = side;
                 is_shadow_ = is_shadow;
                 is_hidden_ = false;
+                level_ = nullptr;
+                is_refill_ = false;
                 replenish(notify, t);
             }
-        template <INotifier N>
+        template <INotifier<Traits> N>
             void reset( const OrderIDType & oid, TimeType t, ClientIDType cid,LocalOrderIDType local_id, PriceType p, SizeType s, SizeType show, Side side, bool is_shadow, N & notify ) 
             {
                 order_id_ = oid;
@@ -200,10 +245,12 @@ namespace SDB{
                 side_ = side;
                 is_shadow_ = is_shadow;
                 is_hidden_ = false;
+                level_ = nullptr;
+                is_refill_ = false;
                 replenish(notify, t);
             }
 
-        void clone( const Order & o ) { 
+        void clone( const BasicOrder & o ) { 
             order_id_  =        o.order_id_ ; 
             creation_time_  =   o.creation_time_ ; 
             client_id_  =       o.client_id_ ;
@@ -216,12 +263,12 @@ namespace SDB{
             is_shadow_  =       o.is_shadow_ ;  
             is_hidden_  =       o.is_hidden_ ;     
         }
-        Order() 
+        BasicOrder() 
         {
             clear();
         }
 
-        template <INotifier N>
+        template <INotifier<Traits> N>
             void replenish( N & notify, const TimeType t) const {
                 if (remaining_size_ < 0)
                     throw std::logic_error(fmt::format("negative remaining size: {}", remaining_size_));
@@ -234,8 +281,8 @@ namespace SDB{
                     notify.log( NotifyMessageType::Ack , *this, t, 0, 0 ); //external world will see a new order popping at the back.
             }
 
-        template <INotifier N>
-            SizeType match( Order & aggressive_order , const TimeType now, N & notify) { 
+        template <INotifier<Traits> N>
+            SizeType match( BasicOrder & aggressive_order , const TimeType now, N & notify) { 
                 if (aggressive_order.side_ == side_) throw std::runtime_error("WTF!!!"); 
                 const SizeType traded_size = std::min(aggressive_order.shown_size_ , shown_size_ );
                 if (traded_size==0) throw std::runtime_error("WTF");
@@ -265,7 +312,7 @@ namespace SDB{
                 return false;
         }
         private: 
-        template <INotifier N>
+        template <INotifier<Traits> N>
             void _traded(SizeType traded_size, PriceType traded_price, const TimeType now, const bool other_side_shadow, N & notify) const { 
                 if ( reduce_size( is_shadow_ , other_side_shadow ) ) { 
                     remaining_size_ -= traded_size;     
@@ -282,7 +329,7 @@ namespace SDB{
         public : 
         struct Hash { 
             using is_transparent = void;
-            size_t operator()( const Order * ptr ) const { 
+            size_t operator()( const BasicOrder * ptr ) const { 
                 return boost::hash<OrderIDType>()(ptr->order_id_);
             }
             size_t operator()( const OrderIDType order_id ) const { 
@@ -291,31 +338,36 @@ namespace SDB{
         };
         struct Eq { 
             using is_transparent = void;
-            size_t operator()( const Order * a, const Order * b ) const { 
+            size_t operator()( const BasicOrder * a, const BasicOrder * b ) const { 
                 return a->order_id_ == b->order_id_;
             }
-            size_t operator()( const OrderIDType a, const Order * b ) const { 
+            size_t operator()( const OrderIDType a, const BasicOrder * b ) const { 
                 return a == b->order_id_;
             }
-            size_t operator()(  const Order * b, const OrderIDType a ) const { 
+            size_t operator()(  const BasicOrder * b, const OrderIDType a ) const { 
                 return a == b->order_id_;
             }
         };
-        using PtrSet = std::unordered_multiset< Order*, Order::Hash, Order::Eq>;
+        using PtrSet = std::unordered_multiset< BasicOrder*, Hash, Eq>;
 
     };
-    struct MarketState { 
-        TimeType time_ ; 
+    using Order = BasicOrder<DefaultTraits> ;
+
+    template <typename Traits>
+    struct BasicMarketState { 
+        typename Traits::TimeType time_ ; 
         double wm_ ;
-        std::array<PriceType, 4> bid_prices_;
-        std::array<SizeType, 4>  bid_sizes_;
+        std::array<typename Traits::PriceType, 4> bid_prices_;
+        std::array<typename Traits::SizeType, 4>  bid_sizes_;
         std::array<float, 4> bid_ages_;
-        std::array<PriceType, 4> ask_prices_;
-        std::array<SizeType, 4>  ask_sizes_;
+        std::array<typename Traits::PriceType, 4> ask_prices_;
+        std::array<typename Traits::SizeType, 4>  ask_sizes_;
         std::array<float, 4> ask_ages_;
     };
+    using MarketState = BasicMarketState<DefaultTraits> ;
 
-    inline std::ostream & operator<<(std::ostream & out, const MarketState & market ) {
+    template <typename Traits>
+    inline std::ostream & operator<<(std::ostream & out, const BasicMarketState<Traits> & market ) {
         out << std::right << std::fixed << std::setw(15)<<  std::setprecision(9) << static_cast<double>(market.time_) * 1e-9
                 << ' '
                 << std::right  << std::setw(3)<<  market.bid_sizes_[2]
@@ -364,7 +416,8 @@ namespace SDB{
 
 namespace std { 
     using namespace SDB;
-    inline string to_string( const Order & o ) { 
+    template <typename Traits>
+    inline string to_string( const BasicOrder<Traits> & o ) { 
         std::ostringstream out; 
         out << "<O: c: " << o.creation_time_*1e-9
             << " " << o.side_  
@@ -383,41 +436,58 @@ namespace std {
 
 namespace SDB { 
 
-    struct Level {
+    //the orders of a level in time priority and the sum of their shown sizes, which whoever changes the orders
+    //or their shown sizes keeps up to date. the part of a level that does not depend on its side.
+    template <typename Traits>
+    struct BasicLevelQueue {
+        //data
+        mutable typename BasicOrder<Traits>::LevelList orders_ ;
+        mutable typename Traits::SizeType shown_ = 0 ;
+    };
+
+    //a price level of one side of the book. the side is a template parameter, so that the bid and offer books are
+    //different types whose ordering is fixed at compile time: nothing in a book looks at the side of a level.
+    template <typename Traits, Side S>
+    struct BasicLevel : public BasicLevelQueue<Traits> {
+        using Order = BasicOrder<Traits> ;
+        using PriceType = typename Traits::PriceType ;
+        using SizeType = typename Traits::SizeType ;
+        using TimeType = typename Traits::TimeType ;
         //sub class
         struct Compare {
             using is_transparent = void;
-            bool operator()( const Level & op, const PriceType & price ) const {
-                if (op.side_ == Side::Offer)
-                    return op.price_ < price;
+            //best price first: highest bid, lowest offer
+            static bool better( const PriceType & a, const PriceType & b ) {
+                if constexpr (S == Side::Offer)
+                    return a < b;
                 else 
-                    return op.price_ > price;
+                    return a > b;
             }
-            bool operator()( const PriceType & price, const Level & op  ) const {
-                if (op.side_ == Side::Offer)
-                    return price < op.price_ ;
-                else 
-                    return price > op.price_ ;
+            bool operator()( const BasicLevel & op, const PriceType & price ) const {
+                return better( op.price_, price );
             }
-            bool operator()( const Level & op, const Level & other ) const {
-                if (op.side_ != other.side_) throw std::runtime_error("Cannot be");
-                return this->operator()( op, other.price_ );
+            bool operator()( const PriceType & price, const BasicLevel & op  ) const {
+                return better( price, op.price_ );
+            }
+            bool operator()( const BasicLevel & op, const BasicLevel & other ) const {
+                return better( op.price_, other.price_ );
             }
         };
-        using SET = std::set<Level, Compare>;
+        using SET = std::set<BasicLevel, Compare>;
+        static_assert( std::is_same_v< typename Order::LevelList, typename MemoryManager<Order>::list_type > );
 
         //data
+        static constexpr Side side_ = S ; 
         const PriceType price_ ; 
-        const Side side_ ; 
         MemoryManager<Order> & mem_;
-        mutable MemoryManager<Order>::list_type orders_ ; 
-        Compare cmp_ ; 
+        using BasicLevelQueue<Traits>::orders_ ;
+        using BasicLevelQueue<Traits>::shown_ ;
 
         //methods
-        Level( PriceType p, Side s, MemoryManager<Order> & mem) : 
-            price_(p), side_(s) , mem_(mem) , orders_() {}
+        BasicLevel( PriceType p, MemoryManager<Order> & mem) : 
+            price_(p), mem_(mem) {}
 
-        friend std::ostream & operator<<(std::ostream & out, const Level & l ) {
+        friend std::ostream & operator<<(std::ostream & out, const BasicLevel & l ) {
             out << "<L: " << std::to_string( l.side_ ) 
                 << " p: " << l.price_ ;
             for (const auto & o : l.orders_ )  {
@@ -427,7 +497,7 @@ namespace SDB {
         }
 
         auto snapshot(const bool record_shadow_orders) const {
-            std::tuple< PriceType, Side, MemoryManager<Order>::list_type > ret;
+            std::tuple< PriceType, Side, typename MemoryManager<Order>::list_type > ret;
             std::get<0>(ret) = price_;
             std::get<1>(ret) = side_;
             for (const Order & o : orders_ ) { 
@@ -439,18 +509,17 @@ namespace SDB {
             return ret;
         }
         
-        void add_order( Order & o, Order::PtrSet & ptr_set ) const { 
+        void add_order( Order & o, typename Order::PtrSet & ptr_set ) const { 
             if (o.price_ != price_ or o.side_ != side_ )
                 throw std::runtime_error("Can't add this order to this level!");
             orders_.push_back( o );
+            shown_ += o.shown_size_;
+            o.level_ = this;
             ptr_set.insert( &o );
         }
 
         SizeType total_shown() const {
-            SizeType n = 0; 
-            for (const auto & o : orders_) 
-                n += o.shown_size_;
-            return n;
+            return shown_;
         }
 
          float average_age(const TimeType now) const {
@@ -476,22 +545,30 @@ namespace SDB {
 
         bool do_prices_agree( const Order & new_order ) const {
             if (side_ == new_order.side_) throw std::runtime_error("WTF");
-            return price_ == new_order.price_ or cmp_( *this, new_order.price_ ); 
+            return not Compare::better( new_order.price_, price_ ); 
         }
 
-        template <INotifier N>
-            void match( Order & new_order, Order::PtrSet & ptr_set, const TimeType now, N & notify ) const { 
+        template <INotifier<Traits> N>
+            void match( Order & new_order, typename Order::PtrSet & ptr_set, const TimeType now, N & notify ) const { 
                 if (not do_prices_agree(new_order) )
                     return;
+                SDB_LATENCY_TIMER(timer, LevelMatch);
                 while (not orders_.empty() && new_order.remaining_size_ > 0) {
                     Order & order_in_book = orders_.front();
+                    const SizeType shown = order_in_book.shown_size_;
                     const SizeType traded_size = order_in_book.match( new_order, now, notify ) ;
                     if (traded_size == 0) throw std::runtime_error("SSSS");
+                    shown_ -= shown - order_in_book.shown_size_;
                     if (order_in_book.shown_size_==0) {
                         orders_.pop_front();
+                        order_in_book.level_ = nullptr;
                         if (order_in_book.remaining_size_!=0) { //hidden
-                            order_in_book.replenish(notify, now);   
                             orders_.push_back( order_in_book ); 
+                            order_in_book.level_ = this;
+                            order_in_book.is_refill_ = true;
+                            order_in_book.replenish(notify, now);   
+                            order_in_book.is_refill_ = false;
+                            shown_ += order_in_book.shown_size_;
                         } else {
                             size_t n_erased = 0; 
                             auto equal_range = ptr_set.equal_range(&order_in_book);
@@ -512,20 +589,24 @@ namespace SDB {
                         new_order.replenish(notify, now);   
                 }
             }
-        void match( Order & new_order, Order::PtrSet & ptr_set, const TimeType now) const { 
+        void match( Order & new_order, typename Order::PtrSet & ptr_set, const TimeType now) const { 
             match( new_order, ptr_set, now, NOOPNotify::instance() );
         }
     };
 
-    template <INotifier N> 
-        Order & get_new_order(
-                MemoryManager<Order> & mem, 
-                OrderIDType oid, TimeType t, ClientIDType cid, LocalOrderIDType lid, PriceType p, SizeType s, SizeType show, Side side, bool is_shadow,
+    using BidLevel = BasicLevel<DefaultTraits, Side::Bid> ;
+    using OfferLevel = BasicLevel<DefaultTraits, Side::Offer> ;
+
+    template <typename Traits, INotifier<Traits> N> 
+        BasicOrder<Traits> & get_new_order(
+                MemoryManager<BasicOrder<Traits>> & mem, 
+                OrderIDType oid, typename Traits::TimeType t, ClientIDType cid, LocalOrderIDType lid,
+                typename Traits::PriceType p, typename Traits::SizeType s, typename Traits::SizeType show, Side side, bool is_shadow,
                 N & notify
                 ) {
             if (s<0)
                 throw std::logic_error(fmt::format("negative order size in a new order: {}", s));
-            Order & o = mem.get_unused();
+            BasicOrder<Traits> & o = mem.get_unused();
             o.reset(oid, t, cid, lid, p, s, show, side, is_shadow, notify);
             if (o.remaining_size_<0)
                 throw std::logic_error(fmt::format("negative remaining size in a new order: {}", o.remaining_size_));
@@ -533,22 +614,36 @@ namespace SDB {
             return o;
         }
 
-    inline Order & get_new_order(
-            MemoryManager<Order> & mem, 
-            OrderIDType oid, TimeType t, ClientIDType cid, LocalOrderIDType lid, PriceType p, SizeType s, SizeType show, Side side, bool is_shadow
+    template <typename Traits>
+    inline BasicOrder<Traits> & get_new_order(
+            MemoryManager<BasicOrder<Traits>> & mem, 
+            OrderIDType oid, typename Traits::TimeType t, ClientIDType cid, LocalOrderIDType lid,
+            typename Traits::PriceType p, typename Traits::SizeType s, typename Traits::SizeType show, Side side, bool is_shadow
             ) {
         return get_new_order(mem, oid, t, cid, lid, p, s, show, side, is_shadow, NOOPNotify::instance() );
     }
-    struct MatchingEngine { 
+
+    //the side of an order is looked at once, in add_order and cancel_order, which hand over to the code of that
+    //side. everything below works on one book at a time.
+    template <typename Traits>
+    struct BasicMatchingEngine { 
+        using Order = BasicOrder<Traits> ;
+        using BidLevel = BasicLevel<Traits, Side::Bid> ;
+        using OfferLevel = BasicLevel<Traits, Side::Offer> ;
+        using PriceType = typename Traits::PriceType ;
+        using SizeType = typename Traits::SizeType ;
+        using TimeType = typename Traits::TimeType ;
+
         OrderIDType next_order_id_ ; 
         TimeType time_ ; 
         MemoryManager<Order> mem_ ; 
-        Level::SET all_bids_, all_offers_ ; 
-        Order::PtrSet ptr_set_;
+        typename BidLevel::SET all_bids_ ; 
+        typename OfferLevel::SET all_offers_ ; 
+        typename Order::PtrSet ptr_set_;
 
-        MatchingEngine() : time_(0) { next_order_id_.fill( std::numeric_limits<OrderIDType::value_type>::min() ); }
+        BasicMatchingEngine() : time_(0) { next_order_id_.fill( std::numeric_limits<OrderIDType::value_type>::min() ); }
 
-        friend std::ostream & operator<<(std::ostream & out, const MatchingEngine & l ) {
+        friend std::ostream & operator<<(std::ostream & out, const BasicMatchingEngine & l ) {
             out << "time: " << l.time_*1e-9 << '\n';
             for (auto it = l.all_offers_.rbegin(); it != l.all_offers_.rend(); ++it)
                 out << *it << '\n' ; 
@@ -558,7 +653,7 @@ namespace SDB {
         }
 
         auto snapshot(const bool record_shadow_orders = true) const { 
-            std::vector< std::tuple< PriceType, Side, MemoryManager<Order>::list_type > > ret;
+            std::vector< std::tuple< PriceType, Side, typename MemoryManager<Order>::list_type > > ret;
             ret.reserve( all_offers_.size() + all_bids_.size() );
             for (auto it = all_offers_.rbegin(); it != all_offers_.rend(); ++it) {
                 auto tpl = it->snapshot(record_shadow_orders);
@@ -577,21 +672,37 @@ namespace SDB {
         void set_time( TimeType time) { 
             time_ = time ; 
         }
-        Level::SET & get_book( const Side s ) { 
-            if (s == Side::Bid) return all_bids_;
-            else return all_offers_ ; 
-        }
+        template <Side S>
+            auto & get_book() { 
+                if constexpr (S == Side::Bid) return all_bids_;
+                else return all_offers_ ; 
+            }
+        template <Side S>
+            const auto & get_book() const { 
+                if constexpr (S == Side::Bid) return all_bids_;
+                else return all_offers_ ; 
+            }
         private: 
-        template <INotifier N> 
+        template <INotifier<Traits> N> 
             void add_order(const OrderIDType oid, const ClientIDType client_id, const LocalOrderIDType lid, 
                     const PriceType price, const SizeType size, const SizeType show, const Side side, const bool is_shadow, N & notify) { 
-                Order & new_order = get_new_order( mem_,oid, time_, client_id, lid, price, size, show, side, is_shadow, notify);
-                auto & all_orders_other_side = get_book( get_other_side(side) );
+                if (side == Side::Bid)
+                    add_order<Side::Bid>( oid, client_id, lid, price, size, show, is_shadow, notify );
+                else
+                    add_order<Side::Offer>( oid, client_id, lid, price, size, show, is_shadow, notify );
+            }
+        template <Side S, INotifier<Traits> N> 
+            void add_order(const OrderIDType oid, const ClientIDType client_id, const LocalOrderIDType lid, 
+                    const PriceType price, const SizeType size, const SizeType show, const bool is_shadow, N & notify) { 
+                SDB_LATENCY_TIMER(timer, AddOrderResting);
+                Order & new_order = get_new_order( mem_,oid, time_, client_id, lid, price, size, show, S, is_shadow, notify);
+                auto & all_orders_other_side = get_book<get_other_side(S)>();
                 while (not all_orders_other_side.empty()) { 
                     const auto top_of_other_side_iter = all_orders_other_side.begin(); 
                     if (not top_of_other_side_iter->do_prices_agree( new_order ) )
                         break;
                     //now match:
+                    SDB_LATENCY_OP(timer, AddOrderMatched);
                     top_of_other_side_iter->match( new_order, ptr_set_, time_, notify );
                     if (top_of_other_side_iter->orders_.empty()) 
                         all_orders_other_side.erase( top_of_other_side_iter );
@@ -599,26 +710,35 @@ namespace SDB {
                         break;
                 }
                 if (new_order.remaining_size_) 
-                    get_book( side ).emplace( price, side, mem_ ).first->add_order( new_order, ptr_set_ ) ;
+                    get_book<S>().emplace( price, mem_ ).first->add_order( new_order, ptr_set_ ) ;
                 else
                     mem_.free(new_order);
                 //notify.log(*this);
             }
         public:
 
-        template <INotifier N> 
+        template <INotifier<Traits> N> 
             void add_simulation_order( const ClientIDType client_id, const LocalOrderIDType lid, const PriceType price, const SizeType size, const SizeType show, const Side side, const bool is_shadow, N & notify) { 
                 //this method is for simulation. 
                 add_order( next_order_id_, client_id, lid, price, size, show, side, is_shadow, notify);
                 increment( next_order_id_);
             }
-        template <INotifier N> 
+        template <INotifier<Traits> N> 
             void add_replay_order( const OrderIDType oid, const ClientIDType client_id, const LocalOrderIDType lid, const PriceType price, const SizeType size, const Side side, const bool is_shadow, N & notify) { 
                 //this method is for simulation. 
                 add_order( oid, client_id, lid, price, size, size, side, is_shadow, notify);
             }
-        template <INotifier N> 
+        //puts order, filled in already, at the back of its price level without matching it. for books restored
+        //from a copy.
+        void rest_order( Order & order ) { 
+            if (order.side_ == Side::Bid)
+                all_bids_.emplace( order.price_, mem_ ).first->add_order( order, ptr_set_ );
+            else
+                all_offers_.emplace( order.price_, mem_ ).first->add_order( order, ptr_set_ );
+        }
+        template <INotifier<Traits> N> 
             void cancel_order( const OrderIDType oid, N & notify ) { 
+                SDB_LATENCY_TIMER(timer, CancelOrder);
                 auto eq_range = ptr_set_.equal_range(oid);
                 for (auto it = eq_range.first; it != eq_range.second; ++it)
                     if ((*it)->order_id_ != oid) 
@@ -632,13 +752,10 @@ namespace SDB {
                     return;
                 }
                 Order & order = **eq_range.first;
-                Level::SET & levels = get_book( order.side_ );
-                auto levels_iterator = levels.find( order.price_ );
-                if (levels_iterator == levels.end()) 
-                    throw std::runtime_error("Cannot find price level " + std::to_string(order.price_));
-                levels_iterator->orders_.erase( levels_iterator->orders_.iterator_to(order) );
-                if ( levels_iterator->orders_.empty() )
-                    levels.erase( levels_iterator );
+                if (order.side_ == Side::Bid)
+                    remove_from_book( all_bids_, order );
+                else
+                    remove_from_book( all_offers_, order );
                 notify.log( NotifyMessageType::Cancel, order, time_ , 0, 0);
                 notify.log( NotifyMessageType::End, order, time_ , 0, 0);
                 ptr_set_.erase( eq_range.first ) ; 
@@ -648,14 +765,154 @@ namespace SDB {
         void cancel_order( const OrderIDType oid ) { 
             cancel_order( oid, NOOPNotify::instance() ) ;
         }
-        template <INotifier N> 
+        //takes size off a resting order, which keeps its place in the queue. nothing left cancels it.
+        //for feeds that report partial cancels.
+        template <INotifier<Traits> N>
+            void reduce_order( const OrderIDType oid, const SizeType size, N & notify ) {
+                auto eq_range = ptr_set_.equal_range(oid);
+                if ( 1 != std::distance( eq_range.first, eq_range.second ) ) {
+                    notify.error( oid, std::to_string(time_) + ": reducing " + std::to_string(oid) + ", which is " +
+                            std::to_string(std::distance( eq_range.first, eq_range.second ) ) + " orders." );
+                    return;
+                }
+                Order & order = **eq_range.first;
+                if (size >= order.remaining_size_) {
+                    cancel_order( oid, notify );
+                    return;
+                }
+                order.remaining_size_ -= size;
+                const SizeType shown = std::min( order.shown_size_, order.remaining_size_ );
+                order.level_->shown_ -= order.shown_size_ - shown;
+                order.shown_size_ = shown;
+            }
+        private:
+        //unlinks order through its level_, the level is only looked up when it became empty
+        template <typename SET>
+            static void remove_from_book( SET & levels, Order & order ) {
+                if (order.level_ == nullptr)
+                    throw std::runtime_error("Order is not in a price level " + std::to_string(order.price_));
+                typename Order::LevelList & level_orders = order.level_->orders_;
+                level_orders.erase( level_orders.iterator_to(order) );
+                order.level_->shown_ -= order.shown_size_;
+                order.level_ = nullptr;
+                if ( not level_orders.empty() )
+                    return;
+                auto levels_iterator = levels.find( order.price_ );
+                if (levels_iterator == levels.end()) 
+                    throw std::runtime_error("Cannot find price level " + std::to_string(order.price_));
+                levels.erase( levels_iterator );
+            }
+        template <typename SET, size_t N>
+            static void level2( const SET & levels, std::array<PriceType, N> & prices, std::array<SizeType, N> & sizes ) {
+                prices.fill(0);
+                sizes.fill(0);
+                size_t i = 0; 
+                for (auto it = levels.begin(); it != levels.end() and i < N; ++i, ++it) {
+                    prices[i] = it->price_ ; 
+                    sizes[i] = it->total_shown() ; 
+                }
+            }
+        template <typename SET, size_t N>
+            static void level25( const SET & levels, const TimeType now,
+                    std::array<PriceType, N> & prices, std::array<SizeType, N> & sizes, std::array<float, N> & ages ) {
+                prices.fill(0);
+                sizes.fill(0);
+                ages.fill(0);
+                size_t i = 0; 
+                for (auto it = levels.begin(); it != levels.end() and i < N; ++i, ++it) {
+                    prices[i] = it->price_ ; 
+                    sizes[i] = it->total_shown() ; 
+                    ages[i] = it->average_age(now);
+                }
+            }
+        public:
+        //mass cancels. they walk the levels instead of looking every order up, send the Cancel and End of every
+        //cancelled order, then one book state (none when nothing was cancelled). they return the number of
+        //orders cancelled.
+        template <typename Pred, INotifier<Traits> N> 
+            size_t cancel_if( Pred pred, N & notify ) { 
+                const size_t n = cancel_levels( all_bids_, all_bids_.begin(), all_bids_.end(), pred, notify )
+                    + cancel_levels( all_offers_, all_offers_.begin(), all_offers_.end(), pred, notify );
+                return book_changed( n, notify );
+            }
+        template <INotifier<Traits> N> 
+            size_t cancel_all( N & notify ) { 
+                return cancel_if( []( const Order & ) { return true; }, notify );
+            }
+        template <INotifier<Traits> N> 
+            size_t cancel_client( const ClientIDType client_id, N & notify ) { 
+                return cancel_if( [client_id]( const Order & o ) { return o.client_id_ == client_id; }, notify );
+            }
+        template <INotifier<Traits> N> 
+            size_t cancel_side( const Side side, N & notify ) { 
+                auto all = []( const Order & ) { return true; };
+                const size_t n = side == Side::Bid ?
+                    cancel_levels( all_bids_, all_bids_.begin(), all_bids_.end(), all, notify ) :
+                    cancel_levels( all_offers_, all_offers_.begin(), all_offers_.end(), all, notify ) ;
+                return book_changed( n, notify );
+            }
+        //the orders of side with a price in [low, high]. only the levels in the range are visited.
+        template <INotifier<Traits> N> 
+            size_t cancel_price_range( const Side side, const PriceType low, const PriceType high, N & notify ) { 
+                if (high < low) return 0;
+                const size_t n = side == Side::Bid ?
+                    cancel_price_range( all_bids_, low, high, notify ) :
+                    cancel_price_range( all_offers_, low, high, notify ) ;
+                return book_changed( n, notify );
+            }
+        template <INotifier<Traits> N> 
             void shutdown(N & notify) { 
-                while (not ptr_set_.empty()) {
-                    OrderIDType oid = (*ptr_set_.begin())->order_id_ ; 
-                    cancel_order(oid, notify);
-                    notify.log( *this );
+                cancel_all( notify );
+            }
+        private:
+        template <typename SET, INotifier<Traits> N> 
+            size_t cancel_price_range( SET & levels, const PriceType low, const PriceType high, N & notify ) { 
+                using Compare = typename SET::value_type::Compare ;
+                //levels are best first: from the better of the two ends to past the worse one
+                const PriceType first = Compare::better( low, high ) ? low : high ;
+                const PriceType last = first == low ? high : low ;
+                auto all = []( const Order & ) { return true; };
+                return cancel_levels( levels, levels.lower_bound( first ), levels.upper_bound( last ), all, notify );
+            }
+        template <typename SET, typename Pred, INotifier<Traits> N> 
+            size_t cancel_levels( SET & levels, typename SET::iterator first, const typename SET::iterator last, Pred & pred, N & notify ) { 
+                size_t n = 0;
+                while (first != last) {
+                    auto & orders = first->orders_;
+                    for (auto it = orders.begin(); it != orders.end(); ) {
+                        Order & order = *it;
+                        if (not pred( std::as_const(order) )) {
+                            ++it;
+                            continue;
+                        }
+                        it = orders.erase( it );
+                        first->shown_ -= order.shown_size_;
+                        order.level_ = nullptr;
+                        notify.log( NotifyMessageType::Cancel, order, time_ , 0, 0);
+                        notify.log( NotifyMessageType::End, order, time_ , 0, 0);
+                        erase_from_ptr_set( order );
+                        mem_.free(order);
+                        ++n;
+                    }
+                    first = orders.empty() ? levels.erase( first ) : std::next( first );
+                }
+                return n;
+            }
+        void erase_from_ptr_set( Order & order ) {
+            auto eq_range = ptr_set_.equal_range( &order );
+            for (auto it = eq_range.first; it != eq_range.second; ++it)
+                if (*it == &order) {
+                    ptr_set_.erase( it );
+                    return;
                 }
+            throw std::runtime_error("Order is not in the order set " + std::to_string(order));
+        }
+        template <INotifier<Traits> N> 
+            size_t book_changed( const size_t n, N & notify ) const { 
+                if (n > 0) notify.log( *this );
+                return n;
             }
+        public:
 
 
         template<size_t N> 
@@ -665,24 +922,9 @@ namespace SDB {
                     std::array<PriceType, N> & ask_prices, 
                     std::array<SizeType, N> & ask_sizes ) const 
             { 
-                bid_prices.fill(0);
-                ask_prices.fill(0);
-                bid_sizes.fill(0);
-                ask_sizes.fill(0);
-                size_t i = 0; 
-                auto it = all_bids_.begin();
-                while( it != all_bids_.end() and i < N ) {
-                    bid_prices[i] = it->price_ ; 
-                    bid_sizes[i] = it->total_shown() ; 
-                    ++i ; ++it ;
-                }
-                i = 0; 
-                it = all_offers_.begin();
-                while( it != all_offers_.end() and i < N ) {
-                    ask_prices[i] = it->price_ ; 
-                    ask_sizes[i] = it->total_shown() ; 
-                    ++i ; ++it ;
-                }
+                SDB_LATENCY_TIMER(timer, Level2);
+                level2( all_bids_, bid_prices, bid_sizes );
+                level2( all_offers_, ask_prices, ask_sizes );
             }
         template<size_t N> 
             void level25( 
@@ -694,40 +936,82 @@ namespace SDB {
                     std::array<float, N> & ask_ages 
                     ) const 
             { 
-                bid_prices.fill(0);
-                ask_prices.fill(0);
-                bid_sizes.fill(0);
-                ask_sizes.fill(0);
-                bid_ages.fill(0);
-                ask_ages.fill(0);
-                size_t i = 0; 
-                auto it = all_bids_.begin();
-                while( it != all_bids_.end() and i < N ) {
-                    bid_prices[i] = it->price_ ; 
-                    bid_sizes[i] = it->total_shown() ; 
-                    bid_ages[i] = it->average_age(time_);
-                    ++i ; ++it ;
-                }
-                i = 0; 
-                it = all_offers_.begin();
-                while( it != all_offers_.end() and i < N ) {
-                    ask_prices[i] = it->price_ ; 
-                    ask_sizes[i] = it->total_shown() ; 
-                    ask_ages[i] = it->average_age(time_);
-                    ++i ; ++it ;
-                }
+                SDB_LATENCY_TIMER(timer, Level25);
+                level25( all_bids_, time_, bid_prices, bid_sizes, bid_ages );
+                level25( all_offers_, time_, ask_prices, ask_sizes, ask_ages );
             }
+        //from the best levels as they are, an empty side being price and size 0. FeaturePipeline (feature_pipeline.h) has
+        //the one that is NaN unless both sides are there.
         double wm() const {
-            std::array<PriceType, 1> bid_prices, ask_prices;
-            std::array<SizeType, 1> bid_sizes, ask_sizes;
-            level2( bid_prices, bid_sizes, ask_prices, ask_sizes ) ;
-            const SizeType tot = bid_sizes[0] + ask_sizes[0] ; 
+            const int64_t bp = all_bids_.empty() ? 0 : all_bids_.begin()->price_ ;
+            const int64_t bs = all_bids_.empty() ? 0 : all_bids_.begin()->total_shown() ;
+            const int64_t ap = all_offers_.empty() ? 0 : all_offers_.begin()->price_ ;
+            const int64_t as = all_offers_.empty() ? 0 : all_offers_.begin()->total_shown() ;
+            const int64_t tot = bs + as ; //two SizeType sums need not fit in SizeType
             if (not tot) 
                 return std::numeric_limits<double>::quiet_NaN(); 
             else
-                return double(bid_prices[0]*ask_sizes[0] + ask_prices[0]*bid_sizes[0])/double(tot);
+                return double(bp*as + ap*bs)/double(tot);
         }
+
+        //queries on the shown sizes, from the best level of a side on. every level costs one step, the shown
+        //size of a level is kept with it.
+
+        //taking size from side, as an order that sweeps it would: buying takes from the offers
+        struct Fill {
+            int64_t size_ ; //of size, what there is
+            int64_t notional_ ; //sum of price times size
+            PriceType last_price_ ; //the worst price taken: what clears size, when size_ is all of it
+            size_t levels_ ;
+            double vwap() const {
+                return size_ ? double(notional_)/double(size_) : std::numeric_limits<double>::quiet_NaN();
+            }
+        };
+        Fill fill( const Side side, const int64_t size ) const {
+            return side == Side::Bid ? fill( all_bids_, size ) : fill( all_offers_, size );
+        }
+        //shown size of side at limit or better: what an order at limit on the other side can take, fill or kill
+        int64_t size_through( const Side side, const PriceType limit ) const {
+            return side == Side::Bid ? size_through( all_bids_, limit ) : size_through( all_offers_, limit );
+        }
+        //shown size of side within ticks of its best price, 0 ticks being the best level
+        int64_t depth( const Side side, const int64_t ticks ) const {
+            return side == Side::Bid ? depth( all_bids_, ticks ) : depth( all_offers_, ticks );
+        }
+
+        private:
+        template <typename SET>
+            static Fill fill( const SET & levels, const int64_t size ) {
+                Fill f{ 0, 0, 0, 0 };
+                for (auto it = levels.begin(); it != levels.end() and f.size_ < size; ++it) {
+                    const int64_t take = std::min<int64_t>( it->total_shown(), size - f.size_ );
+                    f.size_ += take;
+                    f.notional_ += take * it->price_;
+                    f.last_price_ = it->price_;
+                    ++f.levels_;
+                }
+                return f;
+            }
+        template <typename SET>
+            static int64_t size_through( const SET & levels, const PriceType limit ) {
+                using Compare = typename SET::value_type::Compare ;
+                int64_t n = 0;
+                for (auto it = levels.begin(); it != levels.end() and not Compare::better( limit, it->price_ ); ++it)
+                    n += it->total_shown();
+                return n;
+            }
+        template <typename SET>
+            static int64_t depth( const SET & levels, const int64_t ticks ) {
+                if (levels.empty() or ticks < 0) return 0;
+                const int64_t best = levels.begin()->price_;
+                int64_t n = 0;
+                for (auto it = levels.begin(); it != levels.end() and std::abs( it->price_ - best ) <= ticks; ++it)
+                    n += it->total_shown();
+                return n;
+            }
     };
+    using MatchingEngine = BasicMatchingEngine<DefaultTraits> ;
+
     struct LogNotify {
         MarketState market_;
         static void log( const NotifyMessageType mtype , const Order & o, const TimeType t, const SizeType trade_size,
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//hardware performance counters of the calling thread, read with linux perf_event_open.
+//the counters are opened as one group, so they are all counting over the same instructions. user space only,
+//which is what perf_event_paranoid 2 (the usual default) allows. when the kernel refuses a counter (paranoid 3,
+//no PMU in a vm, not linux) it is left out and reported as missing, nothing throws.
+//
+//  PerfCounters counters;
+//  PerfSample sample;
+//  { PerfScope scope(counters, sample); ...work... }
+//  sample.per_op(PerfEvent::Cycles, n_ops);
+
+namespace SDB {
+
+    enum class PerfEvent : std::uint8_t {
+        Cycles,
+        Instructions,
+        L1dMisses, //L1 data cache read misses
+        LLCMisses, //last level cache read misses
+        BranchMisses,
+        DTLBMisses, //data TLB read misses
+        N
+    };
+    constexpr size_t N_PERF_EVENTS = static_cast<size_t>(PerfEvent::N) ;
+
+    inline const char * perf_event_name( const PerfEvent e ) {
+        constexpr std::array<const char *, N_PERF_EVENTS> names {
+            "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses" };
+        return names.at( static_cast<size_t>(e) );
+    }
+
+    //counts accumulated over one or more scopes
+    struct PerfSample {
+        std::array<double, N_PERF_EVENTS> counts_ {} ;
+        std::array<bool, N_PERF_EVENTS> valid_ {} ;
+        size_t n_ = 0 ; //scopes added up
+
+        double operator[]( const PerfEvent e ) const { return counts_[static_cast<size_t>(e)]; }
+        bool valid( const PerfEvent e ) const { return valid_[static_cast<size_t>(e)]; }
+
+        //a counter stays valid only if it was valid in every scope
+        PerfSample & operator+=( const PerfSample & other ) {
+            for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+                counts_[i] += other.counts_[i];
+                valid_[i] = (n_ == 0 or valid_[i]) and other.valid_[i];
+            }
+            n_ += other.n_;
+            return *this;
+        }
+        //NaN when the counter is missing
+        double per_op( const PerfEvent e, const size_t ops ) const {
+            if (not valid(e) or ops == 0) return std::numeric_limits<double>::quiet_NaN();
+            return (*this)[e] / static_cast<double>(ops);
+        }
+    };
+
+    struct PerfCounters {
+        //data
+        std::array<int, N_PERF_EVENTS> fds_ ; //-1 for counters that could not be opened
+        std::array<uint64_t, N_PERF_EVENTS> ids_ ;
+        int leader_ ;
+        std::string error_ ; //why counters are missing, empty when all are there
+
+        PerfCounters() : leader_(-1) {
+            fds_.fill(-1);
+            ids_.fill(0);
+#ifdef __linux__
+            for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+                perf_event_attr attr;
+                std::memset( &attr, 0, sizeof(attr) );
+                attr.size = sizeof(attr);
+                set_event( attr, static_cast<PerfEvent>(i) );
+                attr.disabled = leader_ < 0 ? 1 : 0; //the group is switched on and off through its leader
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                const int fd = static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, leader_, 0 ) );
+                if (fd < 0) {
+                    if (error_.empty())
+                        error_ = std::string(perf_event_name(static_cast<PerfEvent>(i))) + ": " + std::strerror(errno) + paranoid();
+                    continue;
+                }
+                if (ioctl( fd, PERF_EVENT_IOC_ID, &ids_[i] ) != 0) {
+                    ::close(fd);
+                    continue;
+                }
+                fds_[i] = fd;
+                if (leader_ < 0) leader_ = fd;
+            }
+#else
+            error_ = "hardware counters need linux";
+#endif
+        }
+        ~PerfCounters() {
+#ifdef __linux__
+            for (const int fd : fds_)
+                if (fd >= 0) ::close(fd);
+#endif
+        }
+        PerfCounters( const PerfCounters & ) = delete;
+        PerfCounters & operator=( const PerfCounters & ) = delete;
+
+        bool available() const { return leader_ >= 0; }
+        bool available( const PerfEvent e ) const { return fds_[static_cast<size_t>(e)] >= 0; }
+
+        void start() {
+#ifdef __linux__
+            if (not available()) return;
+            ioctl( leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+            ioctl( leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+#endif
+        }
+
+        //counts since start(), scaled up when the kernel had to multiplex the group
+        PerfSample stop() {
+            PerfSample s;
+            s.n_ = 1;
+#ifdef __linux__
+            if (not available()) return s;
+            ioctl( leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+            //nr, time enabled, time running, then a (value, id) pair per counter
+            std::array<uint64_t, 3 + 2*N_PERF_EVENTS> buf {};
+            if (::read( leader_, buf.data(), sizeof(buf) ) < static_cast<ssize_t>(3*sizeof(uint64_t))) return s;
+            const uint64_t nr = buf[0], enabled = buf[1], running = buf[2];
+            if (running == 0) return s; //never got on the pmu
+            const double scale = static_cast<double>(enabled) / static_cast<double>(running);
+            for (uint64_t k = 0; k < nr and k < N_PERF_EVENTS; ++k)
+                for (size_t i = 0; i < N_PERF_EVENTS; ++i)
+                    if (fds_[i] >= 0 and ids_[i] == buf[4 + 2*k]) {
+                        s.counts_[i] = scale * static_cast<double>(buf[3 + 2*k]);
+                        s.valid_[i] = true;
+                    }
+#endif
+            return s;
+        }
+
+        private:
+#ifdef __linux__
+        static void set_event( perf_event_attr & attr, const PerfEvent e ) {
+            auto cache = []( perf_event_attr & a, const uint64_t cache_id ) {
+                a.type = PERF_TYPE_HW_CACHE;
+                a.config = cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            };
+            attr.type = PERF_TYPE_HARDWARE;
+            switch (e) {
+                case PerfEvent::Cycles : attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                case PerfEvent::Instructions : attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                case PerfEvent::L1dMisses : cache( attr, PERF_COUNT_HW_CACHE_L1D ); break;
+                case PerfEvent::LLCMisses : cache( attr, PERF_COUNT_HW_CACHE_LL ); break;
+                case PerfEvent::BranchMisses : attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+                case PerfEvent::DTLBMisses : cache( attr, PERF_COUNT_HW_CACHE_DTLB ); break;
+                case PerfEvent::N : break;
+            }
+        }
+        static std::string paranoid() {
+            std::ifstream in("/proc/sys/kernel/perf_event_paranoid");
+            int level = 0;
+            if (in >> level) return " (perf_event_paranoid is " + std::to_string(level) + ")";
+            return "";
+        }
+#endif
+    };
+
+    //counts the enclosing scope and adds it to sample
+    struct PerfScope {
+        PerfCounters & counters_ ;
+        PerfSample & sample_ ;
+        PerfScope( PerfCounters & counters, PerfSample & sample ) : counters_(counters), sample_(sample) { counters_.start(); }
+        ~PerfScope() { sample_ += counters_.stop(); }
+        PerfScope( const PerfScope & ) = delete;
+    };
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "ob.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+//where the time of an experiment() run goes. the loop marks its phases with PhaseSpan; a PhaseTracer adds up
+//the ticks of every phase over windows of window_ steps, and optionally keeps the first max_spans_ spans one
+//by one. write_chrome_trace() writes both as trace event json (chrome://tracing, ui.perfetto.dev): the windows as
+//counter tracks of nanoseconds per step of every phase, with the number of live orders next to them, the spans
+//as slices. without a tracer (nullptr) a span costs a pointer test.
+
+namespace SDB {
+
+    enum class ExperimentPhase : std::uint8_t {
+        WakeUp, //next action time of every agent, transport delay
+        StateChanged, //markets_state_changed of every agent
+        Send, //transport.send: engine calls and notifications
+        Publish, //level25, weighted mid, market state out
+        ParamUpdate, //ensemble.update
+        Stats, //parameter statistics out
+        N
+    };
+    constexpr size_t N_EXPERIMENT_PHASES = static_cast<size_t>(ExperimentPhase::N) ;
+
+    inline const char * experiment_phase_name( const ExperimentPhase p ) {
+        constexpr std::array<const char *, N_EXPERIMENT_PHASES> names {
+            "wake_up", "state_changed", "send", "publish", "param_update", "stats" };
+        return names.at( static_cast<size_t>(p) );
+    }
+
+    struct PhaseTracer {
+        struct Window {
+            uint64_t tick0_, tick1_ ; //wall clock
+            TimeType t0_, t1_ ; //simulated
+            size_t steps_ ;
+            int64_t orders_ ; //live orders at the end of the window
+            std::array<uint64_t, N_EXPERIMENT_PHASES> ticks_ ;
+        };
+        struct Span {
+            ExperimentPhase phase_ ;
+            uint64_t tick0_, tick1_ ;
+        };
+
+        //data
+        const size_t window_ ;
+        const size_t max_spans_ ;
+        std::vector<Window> windows_ ;
+        std::vector<Span> spans_ ;
+        Window current_ ;
+        const uint64_t origin_ ;
+
+        explicit PhaseTracer( const size_t window = 10000, const size_t max_spans = 0 ) :
+            window_(std::max<size_t>(window, 1)), max_spans_(max_spans), origin_(LatencyClock::now()) {
+                reset( origin_, 0 );
+            }
+
+        void record( const ExperimentPhase p, const uint64_t tick0, const uint64_t tick1 ) {
+            current_.ticks_[static_cast<size_t>(p)] += tick1 - tick0;
+            if (spans_.size() < max_spans_) spans_.push_back( {p, tick0, tick1} );
+        }
+
+        //end of a step of the loop, at simulated time t with orders live orders
+        void step( const TimeType t, const int64_t orders ) {
+            current_.t1_ = t;
+            current_.orders_ = orders;
+            if (++current_.steps_ == window_) close();
+        }
+        //end of the run: keeps the last, partial window
+        void finish() {
+            if (current_.steps_ > 0) close();
+        }
+
+        //total over the windows of every phase, in nanoseconds
+        std::array<double, N_EXPERIMENT_PHASES> totals_ns() const {
+            std::array<double, N_EXPERIMENT_PHASES> ns {};
+            for (const auto & w : windows_)
+                for (size_t i = 0; i < N_EXPERIMENT_PHASES; ++i) ns[i] += static_cast<double>(w.ticks_[i]);
+            for (auto & x : ns) x *= LatencyClock::ns_per_tick();
+            return ns;
+        }
+
+        //one line per phase: total time and share
+        void dump( std::ostream & out ) const {
+            const auto ns = totals_ns();
+            double total = 0;
+            for (const double x : ns) total += x;
+            for (size_t i = 0; i < N_EXPERIMENT_PHASES; ++i)
+                out << fmt::format( "{:<14} {:>12.3f} ms {:>6.1f}%\n", experiment_phase_name(static_cast<ExperimentPhase>(i)),
+                        1e-6*ns[i], total > 0 ? 100*ns[i]/total : 0. );
+        }
+
+        void write_chrome_trace( std::ostream & out ) const {
+            const double k = LatencyClock::ns_per_tick();
+            auto us = [this, k]( const uint64_t tick ) { return 1e-3*k*static_cast<double>(tick - origin_); };
+            out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+            bool first = true;
+            auto sep = [&first, &out]() { out << (first ? "\n" : ",\n"); first = false; };
+            for (const auto & w : windows_) {
+                const double steps = static_cast<double>(w.steps_);
+                sep();
+                out << fmt::format( "{{\"name\": \"ns_per_step\", \"ph\": \"C\", \"ts\": {:.3f}, \"pid\": 0, \"tid\": 0, \"args\": {{", us(w.tick0_) );
+                for (size_t i = 0; i < N_EXPERIMENT_PHASES; ++i)
+                    out << fmt::format( "{}\"{}\": {:.1f}", i ? ", " : "", experiment_phase_name(static_cast<ExperimentPhase>(i)),
+                            k*static_cast<double>(w.ticks_[i])/steps );
+                out << "}}";
+                sep();
+                out << fmt::format( "{{\"name\": \"book\", \"ph\": \"C\", \"ts\": {:.3f}, \"pid\": 0, \"tid\": 0, \"args\": {{\"orders\": {}}}}}",
+                        us(w.tick0_), w.orders_ );
+                sep();
+                out << fmt::format( "{{\"name\": \"simulated_hours\", \"ph\": \"C\", \"ts\": {:.3f}, \"pid\": 0, \"tid\": 0, \"args\": {{\"hours\": {:.6f}}}}}",
+                        us(w.tick0_), static_cast<double>(w.t1_)/3600e9 );
+            }
+            for (const auto & s : spans_) {
+                sep();
+                out << fmt::format( "{{\"name\": \"{}\", \"cat\": \"experiment\", \"ph\": \"X\", \"ts\": {:.3f}, \"dur\": {:.3f}, \"pid\": 0, \"tid\": 1}}",
+                        experiment_phase_name(s.phase_), us(s.tick0_), 1e-3*k*static_cast<double>(s.tick1_ - s.tick0_) );
+            }
+            out << "\n]}\n";
+        }
+
+        private:
+        void reset( const uint64_t tick, const TimeType t ) {
+            current_ = Window{ tick, tick, t, t, 0, 0, {} };
+        }
+        void close() {
+            current_.tick1_ = LatencyClock::now();
+            windows_.push_back( current_ );
+            reset( current_.tick1_, current_.t1_ );
+        }
+    };
+
+    //adds the enclosing scope to tracer under phase, nothing when tracer is nullptr
+    struct PhaseSpan {
+        PhaseTracer * const tracer_ ;
+        const ExperimentPhase phase_ ;
+        const uint64_t tick0_ ;
+        PhaseSpan( PhaseTracer * tracer, const ExperimentPhase phase ) :
+            tracer_(tracer), phase_(phase), tick0_(tracer != nullptr ? LatencyClock::now() : 0) {}
+        ~PhaseSpan() { if (tracer_ != nullptr) tracer_->record( phase_, tick0_, LatencyClock::now() ); }
+        PhaseSpan( const PhaseSpan & ) = delete;
+    };
+
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "boost/multi_index/ordered_index_fwd.hpp"
 #include "ob.h"
+#include "counter_rng.h"
+#include "event_store.h"
 
 #include <boost/random/exponential_distribution.hpp> 
 #include <boost/random/poisson_distribution.hpp> 
@@ -20,7 +22,9 @@
 
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <stdexcept>
+#include <tuple>
 
 namespace SDB { 
 
@@ -39,6 +43,8 @@ namespace SDB {
             mutable boost::random::normal_distribution<double> order_price_;
             const boost::random::poisson_distribution<SizeType, double> order_size_;
             const boost::random::bernoulli_distribution<double> side_;
+            //when set, draws come from here instead of mt_. shared by copies, like mt_.
+            std::shared_ptr<AgentRandomStream> rng_ ;
 
         public : 
             ClientType( 
@@ -60,27 +66,33 @@ namespace SDB {
                 side_(side_mean_) 
         { }
 
+            //draw from the counter based stream of (run, type id) from now on. every client of the type
+            //shares it, so the type's draws do not depend on the other types in the simulation.
+            void use_counter_rng( const uint64_t run, const uint32_t type_id ) {
+                rng_ = std::make_shared<AgentRandomStream>( run, type_id );
+            }
+
             SizeType get_size() const { 
-                return 1 + order_size_(mt_);
+                return 1 + (rng_ ? rng_->poisson<SizeType>(order_size_mean_) : order_size_(mt_));
             }
 
             double get_price() const { 
-                return order_price_(mt_);
+                return rng_ ? rng_->normal(0, order_price_std_) : order_price_(mt_);
             }
             TimeType get_placement_dt() const {
                 //return TimeType(lround(1e9*placement_(mt_)));
-                return safe_round<TimeType>(1e9*placement_(mt_));
+                return safe_round<TimeType>(1e9*(rng_ ? rng_->exponential(placement_lambda_) : placement_(mt_)));
             }
             TimeType get_cancellation_dt( ) const {
                 //return TimeType(lround(1e9*cancellation_(mt_)));
-                return safe_round<TimeType>(1e9*cancellation_(mt_));
+                return safe_round<TimeType>(1e9*(rng_ ? rng_->exponential(cancellation_lambda_) : cancellation_(mt_)));
             }
 
             auto get_next_placement_info() const { 
                 const TimeType t = get_placement_dt();
                 const double p = get_price();
                 const SizeType size = get_size();
-                const Side side = side_(mt_) ? Side::Bid : Side::Offer;
+                const Side side = (rng_ ? rng_->bernoulli(side_mean_) : side_(mt_)) ? Side::Bid : Side::Offer;
                 return  std::make_tuple(t, p, size, side);
             }
 
@@ -354,19 +366,21 @@ namespace SDB {
         explicit replay_error( const std::string & what) : std::runtime_error(what) {}
     };
 
-    struct OrderBookEvent {
-        TimeType event_time_; 
+    template <typename Traits>
+    struct BasicOrderBookEvent {
+        using traits_type = Traits ;
+        typename Traits::TimeType event_time_; 
         OrderIDType oid_ ; 
-        PriceType price_, trade_price_ ; 
-        SizeType size_, trade_size_ ; 
+        typename Traits::PriceType price_, trade_price_ ; 
+        typename Traits::SizeType size_, trade_size_ ; 
         NotifyMessageType mtype_ ;        
         Side side_ ; 
         struct TimeLess { 
-            bool operator()( const OrderBookEvent & a, const OrderBookEvent & b ) const {
+            bool operator()( const BasicOrderBookEvent & a, const BasicOrderBookEvent & b ) const {
                 return a.event_time_ < b.event_time_ ;
             }
         };
-        friend std::ostream & operator<<(std::ostream & out, const OrderBookEvent & obe ) {
+        friend std::ostream & operator<<(std::ostream & out, const BasicOrderBookEvent & obe ) {
             out << "<OBE @ " <<  obe.event_time_ 
                 << " " << obe.mtype_
                 << " " << obe.side_
@@ -379,18 +393,20 @@ namespace SDB {
             return out;
         }
     };
+    using OrderBookEvent = BasicOrderBookEvent<DefaultTraits> ;
+
     struct OrderBookEventWithClientID : public OrderBookEvent {
         ClientIDType cid_ ; 
     };
 
     template <typename T> 
         concept OBEConcept = requires ( T & obe ) {
-            { obe.event_time_ } -> std::same_as<TimeType&>;
+            { obe.event_time_ } -> std::same_as<typename T::traits_type::TimeType&>;
             { obe.oid_ } -> std::same_as<OrderIDType&>;
-            { obe.price_ } -> std::same_as<PriceType&>;
-            { obe.trade_price_ } -> std::same_as<PriceType&>;
-            { obe.size_ } -> std::same_as<SizeType&>;
-            { obe.trade_size_ } -> std::same_as<SizeType&>;
+            { obe.price_ } -> std::same_as<typename T::traits_type::PriceType&>;
+            { obe.trade_price_ } -> std::same_as<typename T::traits_type::PriceType&>;
+            { obe.size_ } -> std::same_as<typename T::traits_type::SizeType&>;
+            { obe.trade_size_ } -> std::same_as<typename T::traits_type::SizeType&>;
             { obe.mtype_ } -> std::same_as<NotifyMessageType&>;
             { obe.side_ } -> std::same_as<Side&>;
         };
@@ -398,6 +414,33 @@ namespace SDB {
     inline ClientIDType get_cid( const OrderBookEvent & , ClientIDType cid ) { return cid ; } 
     inline ClientIDType get_cid( const OrderBookEventWithClientID & obe, ClientIDType ) { return obe.cid_  ; } 
 
+    //the fields of the message at it: an iterator to events, or an EventStore::Cursor reading them from its columns
+    template <typename It>
+        TimeType msg_time( const It & it ) {
+            if constexpr (requires { it.time(); }) return it.time();
+            else return it->event_time_;
+        }
+    template <typename It>
+        NotifyMessageType msg_mtype( const It & it ) {
+            if constexpr (requires { it.mtype(); }) return it.mtype();
+            else return it->mtype_;
+        }
+    template <typename It>
+        const OrderIDType & msg_oid( const It & it ) {
+            if constexpr (requires { it.oid(); }) return it.oid();
+            else return it->oid_;
+        }
+    template <typename It>
+        Side msg_side( const It & it ) {
+            if constexpr (requires { it.side(); }) return it.side();
+            else return it->side_;
+        }
+    template <typename It>
+        std::tuple<ClientIDType, PriceType, SizeType> msg_order( const It & it, const ClientIDType default_cid ) {
+            if constexpr (requires { it.cid( default_cid ); }) return { it.cid( default_cid ), it.price(), it.size() };
+            else return { get_cid( *it, default_cid ), it->price_, it->size_ };
+        }
+
 
     inline void emplace_back( std::vector<OrderBookEvent> & vec, 
             const TimeType event_time, 
@@ -448,7 +491,20 @@ namespace SDB {
             }
         };
 
-    template <OBEConcept OBE = OrderBookEvent> 
+    //where RecordingSimulationHandler keeps messages and series: vectors, or blocks that are never copied when
+    //they grow, the messages in columns (event_store.h)
+    template <OBEConcept OBE> 
+        struct VectorStorage {
+            using msgs_type = std::vector<OBE> ;
+            template <typename T> using series_type = std::vector<T> ;
+        };
+    template <OBEConcept OBE, bool DELTA_TIMES = false> 
+        struct ColumnarStorage {
+            using msgs_type = EventStore<OBE, DELTA_TIMES> ;
+            template <typename T> using series_type = ChunkedVector<T> ;
+        };
+
+    template <OBEConcept OBE = OrderBookEvent, typename Storage = VectorStorage<OBE>> 
         struct RecordingSimulationHandler {
             //data
             OrderStatus simulated_order_status_ ;
@@ -457,9 +513,9 @@ namespace SDB {
             const bool record_shadow_trades_;
             MemoryManager<Order> * const mem_;
             std::ostream * out_;
-            std::vector<std::tuple<TimeType,PriceType>> trades_ ; 
-            std::vector<std::tuple<TimeType,double>> wm_ ; 
-            std::vector<OBE> msgs_ ;
+            typename Storage::template series_type<std::tuple<TimeType,PriceType>> trades_ ; 
+            typename Storage::template series_type<std::tuple<TimeType,double>> wm_ ; 
+            typename Storage::msgs_type msgs_ ;
             std::vector< 
                 std::tuple<
                 TimeType, 
@@ -535,6 +591,8 @@ namespace SDB {
                             std::get<2>(tpl).pop_front_and_dispose( disposer );
             }
         };
+    template <OBEConcept OBE = OrderBookEvent> 
+        using ColumnarRecordingSimulationHandler = RecordingSimulationHandler<OBE, ColumnarStorage<OBE>> ;
 
     template <typename T>
         concept ISimulation = requires( T & notifier ) { 
@@ -543,66 +601,113 @@ namespace SDB {
 
     template <typename T> concept ISimulationNotifier = ISimulation<T> && INotifier<T>; 
 
-    template <OBEConcept OBE, ISimulationNotifier SN>
-        void simulate_a(
-                const std::vector<OBE> & msgs, 
-                const std::vector<TimeType> & times,  
-                const std::vector<double> & algo_prices,  
-                const Side side,
-                const std::unordered_set<OrderIDType, boost::hash<OrderIDType>> & ids_not_to_be_used_by_simulator, 
-                const ClientIDType cid_shadow,
-                const ClientIDType default_cid_market,
-                MatchingEngine & eng,
-                SN & handler
-                ) { 
+    //a message stream compiled once for simulate_a. the same time groups are found, the acks of a group are put
+    //in the order they go into the book, the runs of cancels are collected and End/Trade messages are dropped, so
+    //that replaying, possibly many times, walks three arrays front to back. cancels stay keyed by order id: which
+    //orders are still resting, and where, depends on the shadow order of each replay.
+    struct ReplayProgram {
+        enum class OpType : uint8_t { Add, Cancel };
+        struct Op {
+            OrderIDType oid_ ;
+            ClientIDType cid_ ;
+            PriceType price_ ;
+            SizeType size_ ;
+            Side side_ ;
+            OpType type_ ;
+        };
+        struct Group {
+            TimeType time_ ;
+            uint32_t end_step_ ; //the steps of the group end here, they start where the previous group's end
+        };
 
-            if (times.size() != algo_prices.size()) throw std::runtime_error("sizes");
-            if (times.front() != msgs.front().event_time_) throw std::runtime_error("front");
-            if (times.back() != msgs.back().event_time_) throw std::runtime_error("back");
-            if (times.size() > msgs.size()) throw std::runtime_error(
-                    "times sizes don't work: " + std::to_string(times.size()) + " vs " + std::to_string( msgs.size()) );
+        //data
+        std::vector<Op> ops_ ;
+        std::vector<uint32_t> steps_ ; //end in ops_ of every step. a step is followed by one book state.
+        std::vector<Group> groups_ ; //one per distinct event time, in order
+
+        //msgs: a std::vector or an EventStore of events. an EventStore is walked with a cursor, field by field.
+        template <typename Msgs> requires OBEConcept<typename Msgs::value_type>
+            static ReplayProgram compile( const Msgs & msgs, const ClientIDType default_cid_market ) { 
+                if (msgs.size() > std::numeric_limits<uint32_t>::max())
+                    throw replay_error("too many messages for a replay program: " + std::to_string(msgs.size()));
+                ReplayProgram program;
+                program.ops_.reserve( msgs.size() );
+                if constexpr (requires { msgs.cursor_begin(); })
+                    program.add_groups( msgs.cursor_begin(), msgs.cursor_end(), default_cid_market );
+                else
+                    program.add_groups( msgs.begin(), msgs.end(), default_cid_market );
+                program.ops_.shrink_to_fit();
+                return program;
+            }
 
-            OrderIDType oid; 
-            oid.fill(0);
-            increment(oid, ids_not_to_be_used_by_simulator);
+        //src.next(m) gives the messages one at a time, false at the end: a file reader or a merge of several
+        //sources (event_merge.h). only the messages of one time are held.
+        template <OBEConcept OBE, typename Source>
+            static ReplayProgram compile_stream( Source & src, const ClientIDType default_cid_market ) { 
+                ReplayProgram program;
+                std::vector<OBE> group;
+                OBE m;
+                while (src.next( m )) {
+                    if (not group.empty() and m.event_time_ != group.front().event_time_) {
+                        program.add_group( group.begin(), group.end(), default_cid_market );
+                        group.clear();
+                    }
+                    group.push_back( m );
+                }
+                if (not group.empty()) program.add_group( group.begin(), group.end(), default_cid_market );
+                program.ops_.shrink_to_fit();
+                return program;
+            }
 
-            //PriceType algo_price;
-            double algo_price = std::numeric_limits<double>::quiet_NaN();
-            auto msgs_it = msgs.begin();
-            for ( size_t time_index = 0;  time_index < times.size(); ++time_index ) { 
-                if ( times[time_index] != msgs_it->event_time_ )
-                    throw std::runtime_error("wtf: " + std::to_string(time_index));
-                eng.set_time( msgs_it->event_time_ );
-                const auto same_time_end_it = std::upper_bound( msgs_it, msgs.end(), *msgs_it , OrderBookEvent::TimeLess()) ;
-                if (same_time_end_it != msgs.end() and  same_time_end_it->event_time_ <= msgs_it->event_time_ )
+        //compiles the messages [first, last) after the groups already there. the last time of [first, last) has
+        //to be complete: a stream is compiled piece by piece up to its last time so far.
+        template <typename It>
+            void add_groups( It first, const It last, const ClientIDType default_cid_market ) { 
+                while (first != last) { 
+                    const TimeType t = msg_time( first );
+                    It same_time_end = first;
+                    while (same_time_end != last and msg_time( same_time_end ) == t) ++same_time_end;
+                    add_group( first, same_time_end, default_cid_market );
+                    first = same_time_end;
+                }
+            }
+
+        //the messages [msgs_it, same_time_end_it), all at the same time
+        template <typename It>
+            void add_group( It msgs_it, const It same_time_end_it, const ClientIDType default_cid_market ) { 
+                const TimeType t = msg_time( msgs_it );
+                if (not groups_.empty() and groups_.back().time_ >= t)
                     throw replay_error( std::string("time order has failed: ") +
-                            std::to_string(same_time_end_it->event_time_) + " vs " 
-                            + std::to_string( msgs_it->event_time_ ) );
+                            std::to_string( t ) + " vs " + std::to_string( groups_.back().time_ ) );
+                if (ops_.size() + static_cast<size_t>(same_time_end_it - msgs_it) > std::numeric_limits<uint32_t>::max())
+                    throw replay_error("too many messages for a replay program: " + std::to_string(ops_.size()));
+                auto add = [this, default_cid_market]( const It & it ) {
+                    const auto [cid, price, size] = msg_order( it, default_cid_market );
+                    ops_.push_back( { msg_oid(it), cid, price, size, msg_side(it), OpType::Add } );
+                };
+                auto after = []( It it ) { return ++it; };
                 while ( msgs_it < same_time_end_it ) { 
-                    switch ( msgs_it->mtype_ ) {
+                    switch ( msg_mtype( msgs_it ) ) {
                         case NotifyMessageType::Ack : 
-                            {
-                                for (auto kt = msgs_it + 1; kt  < same_time_end_it ; ++kt ) {
-                                    if( kt->event_time_ != msgs_it->event_time_ ) 
-                                        throw replay_error( std::string("time should be same: ") + 
-                                                std::to_string(kt->event_time_) + " vs " + 
-                                                std::to_string( msgs_it->event_time_ ) );
-                                    if (kt->mtype_== NotifyMessageType::Ack and kt->oid_ != msgs_it->oid_ )
-                                        eng.add_replay_order(kt->oid_, get_cid(*kt,default_cid_market), 0, kt->price_, kt->size_, kt->side_, false, handler);
-                                }
-                                eng.add_replay_order(msgs_it->oid_, get_cid(*msgs_it,default_cid_market), 0, msgs_it->price_, msgs_it->size_, msgs_it->side_, false, handler);
-                                for (auto kt = msgs_it + 1; kt  < same_time_end_it ; ++kt ) {
-                                    if (kt->mtype_== NotifyMessageType::Ack and kt->oid_ == msgs_it->oid_ )
-                                        eng.add_replay_order(kt->oid_, get_cid(*kt,default_cid_market), 0, kt->price_, kt->size_, kt->side_, false, handler);
-                                }
-                                handler.log(eng);
-                                msgs_it = same_time_end_it;
-                            }
+                            //the other orders of the group first, then this one and its refills
+                            for (auto kt = after( msgs_it ); kt < same_time_end_it ; ++kt )
+                                if (msg_mtype(kt) == NotifyMessageType::Ack and msg_oid(kt) != msg_oid(msgs_it) ) add( kt );
+                            add( msgs_it );
+                            for (auto kt = after( msgs_it ); kt < same_time_end_it ; ++kt )
+                                if (msg_mtype(kt) == NotifyMessageType::Ack and msg_oid(kt) == msg_oid(msgs_it) ) add( kt );
+                            steps_.push_back( static_cast<uint32_t>(ops_.size()) );
+                            msgs_it = same_time_end_it;
                             break;
                         case NotifyMessageType::Cancel : 
-                            eng.cancel_order(msgs_it->oid_, handler);
-                            handler.log(eng);
-                            ++msgs_it; 
+                            //a run of cancels at the same time is a mass cancel, which sent one book state
+                            while ( msgs_it < same_time_end_it and (
+                                        msg_mtype(msgs_it) == NotifyMessageType::Cancel or 
+                                        msg_mtype(msgs_it) == NotifyMessageType::End ) ) { 
+                                if (msg_mtype(msgs_it) == NotifyMessageType::Cancel)
+                                    ops_.push_back( { msg_oid(msgs_it), default_cid_market, 0, 0, msg_side(msgs_it), OpType::Cancel } );
+                                ++msgs_it; 
+                            }
+                            steps_.push_back( static_cast<uint32_t>(ops_.size()) );
                             break;
                         case NotifyMessageType::End : 
                         case NotifyMessageType::Trade : 
@@ -610,7 +715,62 @@ namespace SDB {
                             break;
                     } 
                 }
-                //PriceType algo_price_t = std::lround( algo_prices[time_index] );
+                groups_.push_back( { t, static_cast<uint32_t>(steps_.size()) } );
+            }
+
+        //replays the market messages of group g into eng, with a book state after every step
+        template <typename SN>
+            void replay_group( const size_t g, MatchingEngine & eng, SN & handler ) const { 
+                eng.set_time( groups_[g].time_ );
+                const uint32_t first_step = g == 0 ? 0 : groups_[g-1].end_step_;
+                const Op * op = ops_.data() + (first_step == 0 ? 0 : steps_[first_step-1]);
+                for (uint32_t step = first_step; step != groups_[g].end_step_; ++step) { 
+                    for (const Op * const ops_end = ops_.data() + steps_[step] ; op != ops_end; ++op) {
+                        if (op->type_ == OpType::Add)
+                            eng.add_replay_order(op->oid_, op->cid_, 0, op->price_, op->size_, op->side_, false, handler);
+                        else
+                            eng.cancel_order(op->oid_, handler);
+                    }
+                    handler.log(eng);
+                }
+            }
+
+        //the times of simulate_a
+        std::vector<TimeType> times() const { 
+            std::vector<TimeType> ret;
+            ret.reserve( groups_.size() );
+            for (const auto & g : groups_) ret.push_back( g.time_ );
+            return ret;
+        }
+    };
+
+    //replays the groups [first, last) of program into eng, with a shadow order of cid_shadow on side priced at
+    //algo_prices[i] from the i-th time on (none while it is NaN). the order ids of the shadow orders are not in
+    //ids_not_to_be_used_by_simulator. eng has the book as it was before group first.
+    template <ISimulationNotifier SN>
+        void simulate_a(
+                const ReplayProgram & program,
+                const size_t first,
+                const size_t last,
+                const std::vector<double> & algo_prices,  
+                const Side side,
+                const std::unordered_set<OrderIDType, boost::hash<OrderIDType>> & ids_not_to_be_used_by_simulator, 
+                const ClientIDType cid_shadow,
+                MatchingEngine & eng,
+                SN & handler
+                ) { 
+
+            if (program.groups_.size() != algo_prices.size()) throw std::runtime_error("sizes");
+            if (first > last or last > program.groups_.size()) throw std::runtime_error(
+                    "bad group range [" + std::to_string(first) + ", " + std::to_string(last) + ")" );
+
+            OrderIDType oid; 
+            oid.fill(0);
+            increment(oid, ids_not_to_be_used_by_simulator);
+
+            double algo_price = std::numeric_limits<double>::quiet_NaN();
+            for ( size_t time_index = first;  time_index < last; ++time_index ) { 
+                program.replay_group( time_index, eng, handler );
 
                 if ( std::isnan( algo_prices[time_index] ) ) { 
                     //if we have an order, we need to cancel it. 
@@ -620,7 +780,7 @@ namespace SDB {
                     }  
                 } else { 
                     PriceType algo_price_t = safe_round<PriceType>( algo_prices[time_index] );
-                    if (time_index==0) {
+                    if (time_index==first) {
                         eng.add_replay_order( oid , cid_shadow, 0, algo_price_t, 1, side, true, handler );
                     } else if (
                             std::fabs( algo_prices[time_index] - algo_price ) > 1e-7 or 
@@ -633,7 +793,46 @@ namespace SDB {
                     algo_price = algo_prices[time_index]; 
                 }
             }
+        }
+    template <ISimulationNotifier SN>
+        void simulate_a(
+                const ReplayProgram & program,
+                const std::vector<double> & algo_prices,  
+                const Side side,
+                const std::unordered_set<OrderIDType, boost::hash<OrderIDType>> & ids_not_to_be_used_by_simulator, 
+                const ClientIDType cid_shadow,
+                MatchingEngine & eng,
+                SN & handler
+                ) { 
+            simulate_a( program, 0, program.groups_.size(), algo_prices, side, ids_not_to_be_used_by_simulator, cid_shadow, eng, handler );
+        }
+
+    //compiles msgs and replays them. times are the distinct event times of msgs. to replay the same messages
+    //again and again, compile them once and call the ReplayProgram version.
+    template <typename Msgs, ISimulationNotifier SN> requires OBEConcept<typename Msgs::value_type>
+        void simulate_a(
+                const Msgs & msgs, 
+                const std::vector<TimeType> & times,  
+                const std::vector<double> & algo_prices,  
+                const Side side,
+                const std::unordered_set<OrderIDType, boost::hash<OrderIDType>> & ids_not_to_be_used_by_simulator, 
+                const ClientIDType cid_shadow,
+                const ClientIDType default_cid_market,
+                MatchingEngine & eng,
+                SN & handler
+                ) { 
+
+            if (times.size() != algo_prices.size()) throw std::runtime_error("sizes");
+            if (times.front() != msgs.front().event_time_) throw std::runtime_error("front");
+            if (times.back() != msgs.back().event_time_) throw std::runtime_error("back");
+            if (times.size() > msgs.size()) throw std::runtime_error(
+                    "times sizes don't work: " + std::to_string(times.size()) + " vs " + std::to_string( msgs.size()) );
 
+            const ReplayProgram program = ReplayProgram::compile( msgs, default_cid_market );
+            for ( size_t time_index = 0;  time_index < times.size(); ++time_index ) 
+                if ( time_index >= program.groups_.size() or times[time_index] != program.groups_[time_index].time_ )
+                    throw std::runtime_error("wtf: " + std::to_string(time_index));
+            simulate_a( program, algo_prices, side, ids_not_to_be_used_by_simulator, cid_shadow, eng, handler );
         }
     template <OBEConcept OBE = OrderBookEvent> 
         struct StatisticsSimulationHandler {
@@ -641,6 +840,11 @@ namespace SDB {
             TimeType prev_time_;
             double prev_wm_, sum_wm_by_dt_, sum_dt_; //from a trade to trade where wm avg is
             double sum_return_by_dT_, sum_dT_ ; //across trades
+            //for append(): time of the first book state, and the interval before the first shadow trade
+            TimeType first_time_;
+            bool head_trade_;
+            double head_wm_by_dt_, head_dt_, head_trade_price_;
+            int head_side_multiplier_;
 
             StatisticsSimulationHandler( ) :
                 simulated_order_status_(OrderStatus::Unknown),
@@ -649,11 +853,24 @@ namespace SDB {
                 sum_wm_by_dt_(0), 
                 sum_dt_(0),
                 sum_return_by_dT_(0),
-                sum_dT_(0)
+                sum_dT_(0),
+                first_time_(std::numeric_limits<TimeType>::min()),
+                head_trade_(false),
+                head_wm_by_dt_(0),
+                head_dt_(0),
+                head_trade_price_(0),
+                head_side_multiplier_(0)
                 {}
 
             void log( const NotifyMessageType mtype , const Order & o, const TimeType , const SizeType = 0, const PriceType trade_price = 0) { 
                 if (mtype == NotifyMessageType::Trade and o.is_shadow_ ) {
+                    if (not head_trade_) {
+                        head_trade_ = true;
+                        head_wm_by_dt_ = sum_wm_by_dt_;
+                        head_dt_ = sum_dt_;
+                        head_trade_price_ = trade_price;
+                        head_side_multiplier_ = (o.side_ == Side::Offer) ? 1 : -1 ;
+                    }
                     if ( sum_dt_ > EPS ) {
                         const int side_multiplier = (o.side_ == Side::Offer) ? 1 : -1 ;
                         //if I am selling , trade price > wm means I sold high, great:
@@ -683,11 +900,51 @@ namespace SDB {
                         sum_wm_by_dt_ += prev_wm_ * dt;
                         sum_dt_ += dt;
                     } 
+                    if (prev_time_ == std::numeric_limits<TimeType>::min()) first_time_ = eng.time_;
                     prev_wm_ = eng.wm(); 
                     prev_time_ = eng.time_ ; 
                 }
             void error(const OrderIDType &, const std::string &) {}
 
+            //adds the stats of next, a replay that starts where this one stops. the interval still open at the
+            //end of this one runs on over the gap to next and into next, so the first shadow trade of next is
+            //priced again against all of it.
+            void append( const StatisticsSimulationHandler & next ) {
+                if (next.prev_time_ == std::numeric_limits<TimeType>::min()) return; //next saw nothing
+                double open_wm_by_dt = sum_wm_by_dt_, open_dt = sum_dt_;
+                if (not std::isnan( prev_wm_ )) {
+                    const double dt = next.first_time_ - prev_time_ ;
+                    open_wm_by_dt += prev_wm_ * dt;
+                    open_dt += dt;
+                }
+                if (prev_time_ == std::numeric_limits<TimeType>::min()) first_time_ = next.first_time_;
+                sum_return_by_dT_ += next.sum_return_by_dT_;
+                sum_dT_ += next.sum_dT_;
+                if (next.head_trade_) { 
+                    auto contribution = [&next]( const double wm_by_dt, const double dt ) {
+                        return dt > EPS ? next.head_side_multiplier_ * ( next.head_trade_price_ - wm_by_dt / dt ) * dt : 0. ;
+                    };
+                    const double wm_by_dt = open_wm_by_dt + next.head_wm_by_dt_, dt = open_dt + next.head_dt_;
+                    sum_return_by_dT_ += contribution( wm_by_dt, dt ) - contribution( next.head_wm_by_dt_, next.head_dt_ );
+                    sum_dT_ += (dt > EPS ? dt : 0.) - (next.head_dt_ > EPS ? next.head_dt_ : 0.);
+                    if (not head_trade_) { 
+                        head_trade_ = true;
+                        head_wm_by_dt_ = wm_by_dt;
+                        head_dt_ = dt;
+                        head_trade_price_ = next.head_trade_price_;
+                        head_side_multiplier_ = next.head_side_multiplier_;
+                    }
+                    sum_wm_by_dt_ = next.sum_wm_by_dt_;
+                    sum_dt_ = next.sum_dt_;
+                } else { 
+                    sum_wm_by_dt_ = open_wm_by_dt + next.sum_wm_by_dt_;
+                    sum_dt_ = open_dt + next.sum_dt_;
+                }
+                prev_wm_ = next.prev_wm_;
+                prev_time_ = next.prev_time_;
+                simulated_order_status_ = next.simulated_order_status_;
+            }
+
         };
 
 }
@@ -0,0 +1,155 @@
+#pragma once
+#include "ob.h"
+#include "labels.h"
+#include "feature_pipeline.h"
+
+#include <ATen/ATen.h>
+#include <torch/serialize.h>
+#include <torch/torch.h>
+
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <string>
+
+namespace SDB {
+
+    //the market columns of a row: time, bid prices, ask prices, bid sizes, ask sizes, bid ages, ask ages. the
+    //number of columns written, N_MARKET_COLUMNS.
+    constexpr size_t N_MARKET_COLUMNS = 1 + 6*std::tuple_size_v<decltype(MarketState::bid_prices_)> ;
+    inline size_t market_row( const MarketState & m, float * row ) {
+        size_t j = 0;
+        row[j++] = static_cast<float>(m.time_*1e-9) ;
+        for ( const auto x : m.bid_prices_ ) row[j++] = static_cast<float>(x) ;
+        for ( const auto x : m.ask_prices_ ) row[j++] = static_cast<float>(x) ;
+        for ( const auto x : m.bid_sizes_ )  row[j++] = static_cast<float>(x) ;
+        for ( const auto x : m.ask_sizes_ )  row[j++] = static_cast<float>(x) ;
+        for ( const auto x : m.bid_ages_ )   row[j++] = static_cast<float>(x) ;
+        for ( const auto x : m.ask_ages_ )   row[j++] = static_cast<float>(x) ;
+        return j;
+    }
+    //a feature as a model input. a feature that is not defined yet (flow() before the first trade, variance() before
+    //the second wm, most of them on an empty book) is 0: a NaN input would stay in the state of a recurrent model
+    //for good. the shards and ModelAgent both go through here, so that training and inference see the same.
+    inline float feature_input( const double x ) { return std::isfinite(x) ? static_cast<float>(x) : 0.f; }
+
+    //writes market states as a sequence of torch tensors ("shards") of at most rows_per_shard rows each.
+    //a row is : time, bid prices, ask prices, bid sizes, ask sizes, bid ages, ask ages,
+    //and the future wm labels (last, high, low, mean, stdev) over horizon, then n_features features when the rows
+    //come with a FeaturePipeline (push(market, features)): the first n_features of its vector through
+    //feature_input(), 0 without one.
+    //rows are held back only until their label window is closed, so memory stays flat however long the run is.
+    //only rows with time in [t_begin, t_end) are written, but later rows still feed the labels.
+    //shards are pickled tensors named <prefix><shard index>.pt and can be read with torch.load.
+    struct TorchShardWriter {
+        static constexpr size_t N_LEVELS = std::tuple_size_v<decltype(MarketState::bid_prices_)> ;
+        static constexpr size_t N_LABELS = 5 ;
+        static constexpr size_t N_COLUMNS = N_MARKET_COLUMNS + N_LABELS ;
+
+        //data
+        const std::string prefix_ ;
+        const size_t rows_per_shard_ ;
+        const TimeType t_begin_, t_end_ ;
+        const size_t n_features_ ;
+        const size_t n_columns_ ; //N_COLUMNS + n_features_
+        WMLabeler labeler_ ;
+        std::deque<MarketState> pending_ ; //rows waiting for their labels
+        std::deque<float> pending_features_ ; //n_features_ for every row of pending_
+        torch::Tensor shard_ ;
+        float * data_ ;
+        size_t n_rows_ ; //rows in the current shard
+        size_t n_shards_ ; //shards written so far
+        size_t n_written_ ; //rows written so far
+
+        //ctor
+        explicit TorchShardWriter(
+                const std::string & prefix,
+                const size_t rows_per_shard = 1000000,
+                const TimeType t_begin = static_cast<TimeType>( 1e9*60*60/2 ),
+                const TimeType t_end = static_cast<TimeType>( 1e9*60*60*23.5 ),
+                const TimeType horizon = static_cast<TimeType>( 1e9*1 ),
+                const size_t n_features = 0 ) :
+            prefix_(prefix), rows_per_shard_(rows_per_shard), t_begin_(t_begin), t_end_(t_end),
+            n_features_(n_features), n_columns_(N_COLUMNS + n_features),
+            labeler_(horizon), data_(nullptr), n_rows_(0), n_shards_(0), n_written_(0) {
+                if (rows_per_shard_ == 0) throw std::runtime_error("rows_per_shard should be positive");
+            }
+        TorchShardWriter( const TorchShardWriter & ) = delete;
+
+        void push( const MarketState & market ) {
+            pending_features_.insert( pending_features_.end(), n_features_, 0.f );
+            push_row( market );
+        }
+        void push( const MarketState & market, const FeaturePipeline & features ) {
+            if (features.size() < n_features_)
+                throw std::runtime_error( fmt::format("{} features, {} columns", features.size(), n_features_) );
+            for (size_t i = 0; i < n_features_; ++i) pending_features_.push_back( feature_input( features[i] ) );
+            push_row( market );
+        }
+
+        //end of data: label the rows that are still waiting and write the last, partial shard.
+        void finish() {
+            labeler_.finish();
+            drain();
+            if (n_rows_ > 0) write_shard();
+        }
+
+        std::string shard_name( const size_t index ) const { return fmt::format("{}{:04d}.pt", prefix_, index); }
+
+        size_t n_columns() const { return n_columns_; }
+
+        private:
+        void push_row( const MarketState & market ) {
+            pending_.push_back( market );
+            labeler_.push( market.time_, market.wm_ );
+            drain();
+        }
+        void drain() {
+            for ( ; labeler_.ready(); labeler_.pop(), pending_.pop_front() ) {
+                const MarketState & m = pending_.front();
+                if (m.time_ >= t_begin_ and m.time_ < t_end_)
+                    add_row( m, labeler_.front() );
+                pending_features_.erase( pending_features_.begin(), pending_features_.begin() + n_features_ );
+            }
+        }
+
+        void add_row( const MarketState & m, const WMLabels & l ) {
+            if (data_ == nullptr) {
+                shard_ = torch::empty({int64_t(rows_per_shard_), int64_t(n_columns_)});
+                if (not shard_.is_contiguous())
+                    throw std::runtime_error("TorchShardWriter expects a contiguous tensor");
+                data_ = shard_.data_ptr<float>();
+            }
+            float * row = data_ + n_rows_*n_columns_ ;
+            size_t j = market_row( m, row );
+            row[j++] = static_cast<float>(l.last_) ;
+            row[j++] = static_cast<float>(l.high_) ;
+            row[j++] = static_cast<float>(l.low_) ;
+            row[j++] = static_cast<float>(l.mean_) ;
+            row[j++] = static_cast<float>(l.stdev_) ;
+            for (size_t i = 0; i < n_features_; ++i) row[j++] = pending_features_[i] ;
+            if (j != n_columns_)
+                throw std::runtime_error( fmt::format(
+                            "Not enough space: We allocated {} columns, but used {} columns.", n_columns_, j ) );
+            if (++n_rows_ == rows_per_shard_) write_shard();
+        }
+
+        void write_shard() {
+            //a view would pickle the whole storage, so the last, partial shard is copied out
+            const auto pickled = torch::pickle_save( n_rows_ == rows_per_shard_ ?
+                    shard_ : shard_.narrow(0, 0, int64_t(n_rows_)).clone() );
+            const std::string fname = shard_name(n_shards_);
+            std::ofstream out( fname, std::ios::out|std::ios::binary );
+            if (not out) throw std::runtime_error("Cannot open " + fname);
+            out.write( pickled.data(), pickled.size() );
+            out.close(); //a full disk may only show when the buffer goes out
+            if (not out) throw std::runtime_error("TorchShardWriter: write failed: " + fname);
+            SPDLOG_INFO("Written {}: {} rows, {} bytes", fname, n_rows_, pickled.size() );
+            n_written_ += n_rows_;
+            n_rows_ = 0;
+            ++n_shards_;
+        }
+    };
+
+}
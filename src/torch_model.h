@@ -0,0 +1,119 @@
+#pragma once
+#include "torch_export.h"
+
+#include <torch/script.h>
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace SDB {
+
+    //a TorchScript model run for many agents at once. every agent has a slot, with the recurrent state of the
+    //model for it. the agents due at a time put their inputs in with request(), and run() makes one forward pass
+    //for all of them: the rows are a batch of sequences of length 1, the states of their slots are taken out
+    //of states_, given to the model and put back. slots that are not in the batch keep their state.
+    //the model is called as forward(x) -> y with no state, forward(x, h) -> (y, h) with one (RNN, GRU),
+    //forward(x, h, c) -> (y, h, c) with two (LSTM): x is [batch, 1, n_inputs], a state [layers, batch, hidden],
+    //y has one number per row. py/train.py has export_step_model() for its LSTM.
+    //a slot steps its state once per request(). a model trained on consecutive shard rows, one per market state
+    //(py/train.py), has to be given every market state in the same way, whatever the rate its predictions are
+    //used at: ModelAgent requests on every market state and only acts every period.
+    struct TorchModelBatch {
+        //data
+        torch::jit::Module module_ ;
+        const size_t n_inputs_ ;
+        const int64_t n_layers_, hidden_ ;
+        std::vector<torch::Tensor> states_ ; //[layers, slots, hidden] each
+        size_t n_slots_ ;
+        std::vector<int64_t> rows_ ; //the slots in the batch
+        std::vector<bool> queued_ ; //by slot, in rows_
+        std::vector<float> inputs_ ; //n_inputs_ for every row
+        std::vector<float> outputs_ ; //the last prediction of every slot
+        std::vector<TimeType> output_times_ ; //and its time
+        size_t n_forwards_, n_predictions_ ;
+
+        TorchModelBatch( torch::jit::Module module, const size_t n_inputs,
+                const size_t n_states = 0, const int64_t n_layers = 0, const int64_t hidden = 0 ) :
+            module_(std::move(module)), n_inputs_(n_inputs), n_layers_(n_layers), hidden_(hidden),
+            n_slots_(0), n_forwards_(0), n_predictions_(0) {
+                if (n_inputs_ == 0) throw std::runtime_error("a model needs inputs");
+                if (n_states > 2) throw std::runtime_error("a model has 0, 1 (h) or 2 (h, c) states, not " + std::to_string(n_states));
+                if (n_states > 0 and (n_layers_ <= 0 or hidden_ <= 0))
+                    throw std::runtime_error("the state of a model needs layers and a hidden size");
+                module_.eval();
+                states_.resize( n_states );
+            }
+        //a model saved with torch.jit.save
+        TorchModelBatch( const std::string & fname, const size_t n_inputs,
+                const size_t n_states = 0, const int64_t n_layers = 0, const int64_t hidden = 0 ) :
+            TorchModelBatch( torch::jit::load( fname ), n_inputs, n_states, n_layers, hidden ) {}
+        TorchModelBatch( const TorchModelBatch & ) = delete;
+
+        //a new slot, with a zero state
+        size_t add_slot() {
+            for (auto & s : states_)
+                s = n_slots_ == 0 ? torch::zeros({n_layers_, 1, hidden_}) : torch::cat({s, torch::zeros({n_layers_, 1, hidden_})}, 1);
+            queued_.push_back( false );
+            outputs_.push_back( std::numeric_limits<float>::quiet_NaN() );
+            output_times_.push_back( std::numeric_limits<TimeType>::min() );
+            return n_slots_++;
+        }
+        //forgets what slot has seen
+        void reset( const size_t slot ) {
+            for (auto & s : states_) s.narrow(1, int64_t(slot), 1).zero_();
+        }
+
+        //a row of n_inputs_ for slot, for the next run(). a slot is in a batch once.
+        void request( const size_t slot, const float * row ) {
+            if (slot >= n_slots_) throw std::runtime_error("no slot " + std::to_string(slot));
+            if (queued_[slot]) throw std::runtime_error("slot " + std::to_string(slot) + " is in the batch already");
+            queued_[slot] = true;
+            rows_.push_back( int64_t(slot) );
+            inputs_.insert( inputs_.end(), row, row + n_inputs_ );
+        }
+        size_t batch_size() const { return rows_.size(); }
+
+        //one forward pass for what has been requested. the predictions are at time t.
+        void run( const TimeType t ) {
+            if (rows_.empty()) return;
+            const int64_t n = int64_t(rows_.size());
+            torch::NoGradGuard no_grad;
+            const torch::Tensor x = torch::from_blob( inputs_.data(), {n, 1, int64_t(n_inputs_)}, torch::kFloat );
+            const torch::Tensor index = torch::from_blob( rows_.data(), {n}, torch::kLong );
+            std::vector<torch::jit::IValue> args{ x };
+            for (const auto & s : states_) args.emplace_back( s.index_select(1, index) );
+            const torch::jit::IValue out = module_.forward( args );
+            torch::Tensor y;
+            if (states_.empty())
+                y = out.isTuple() ? out.toTuple()->elements()[0].toTensor() : out.toTensor();
+            else {
+                const auto & elements = out.toTuple()->elements();
+                if (elements.size() != 1 + states_.size())
+                    throw std::runtime_error( fmt::format("the model gave {} values, we expect {}", elements.size(), 1 + states_.size()) );
+                y = elements[0].toTensor();
+                for (size_t k = 0; k < states_.size(); ++k)
+                    states_[k].index_copy_(1, index, elements[1 + k].toTensor());
+            }
+            y = y.reshape({-1}).to(torch::kFloat).contiguous();
+            if (y.numel() != n)
+                throw std::runtime_error( fmt::format("the model gave {} numbers for {} rows", y.numel(), n) );
+            const float * p = y.data_ptr<float>();
+            for (int64_t i = 0; i < n; ++i) {
+                outputs_[rows_[i]] = p[i];
+                output_times_[rows_[i]] = t;
+                queued_[rows_[i]] = false;
+            }
+            ++n_forwards_;
+            n_predictions_ += rows_.size();
+            rows_.clear();
+            inputs_.clear();
+        }
+
+        bool has_output( const size_t slot, const TimeType t ) const { return output_times_[slot] == t; }
+        float output( const size_t slot ) const { return outputs_[slot]; }
+    };
+
+}